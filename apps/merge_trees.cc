@@ -0,0 +1,53 @@
+// Merges trees grown from the same angles into a single tree file.
+//
+// Usage: merge_trees <out.crl> <in.crl>...
+//
+// Meant for the shards written by `sbranch --shards` and continued with
+// `sbranch --shard`. The leaves of the first tree keep their IDs, and the
+// leaves of the other trees are renumbered after them in the given order.
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+#include "sofa/cereal.h"
+
+int main(int argc, char* argv[]) {
+  try {
+    if (argc < 3) {
+      std::cout << "Usage: " << argv[0] << " <out.crl> <in.crl>..."
+                << std::endl;
+      return 1;
+    }
+
+    std::cout << "Reading tree from: " << argv[2] << std::endl;
+    CerealReader reader(argv[2]);
+    SofaContext ctx(reader);
+    SofaBranchTree t(ctx, reader);
+    reader.close();
+
+    for (int i = 3; i < argc; i++) {
+      std::cout << "Reading tree from: " << argv[i] << std::endl;
+      CerealReader other_reader(argv[i]);
+      if (SofaContext(other_reader) != ctx)
+        throw std::invalid_argument(
+            std::string("Tree built from different angles: ") + argv[i]);
+      SofaBranchTree other(ctx, other_reader);
+      other_reader.close();
+      t.merge(other);
+    }
+
+    std::cout << "Number of valid states: " << t.valid_states().size()
+              << std::endl;
+    CerealWriter writer(argv[1]);
+    writer << ctx << t;
+    writer.close();
+  } catch(std::exception& e) {
+    std::cerr << "error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
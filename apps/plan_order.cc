@@ -0,0 +1,203 @@
+// Plans `branch_order` for an angle partition.
+//
+// Usage: plan_order <angles.json> <out.json> [layers] [samples] [seed]
+//
+// The corners with nonnegative `branch_order` in <angles.json> are ordered
+// greedily: at each step, every remaining corner is tried on a sample of
+// the current frontier and the one with the smallest growth is picked.
+// The first `layers` corners grow the frontier exactly, after which only
+// the children of the sampled states are kept as the next frontier.
+// The given order is estimated the same way, and the better of the two is
+// written to <out.json> together with the estimated number of states and
+// running time after each corner.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+#include "sofa/branch_logic.h"
+
+struct PlanStep {
+  int corner;
+  // Estimated number of states after adding `corner`
+  double states;
+  // Estimated running time of adding `corner` in seconds
+  double seconds;
+};
+
+struct Plan {
+  std::vector<PlanStep> steps;
+
+  double seconds() const {
+    double res = 0;
+    for (const auto &step : steps)
+      res += step.seconds;
+    return res;
+  }
+};
+
+struct Probe {
+  // Mean number of children and running time per sampled state
+  double growth;
+  double seconds;
+  Sink children;
+};
+
+static Probe probe(
+    const std::vector<SofaState> &frontier,
+    const std::vector<size_t> &sample,
+    int corner, bool extend) {
+  Probe res{0, 0, {}};
+  for (auto idx : sample) {
+    SofaState s(frontier[idx]);
+    auto start = std::chrono::steady_clock::now();
+    add_corner(s, corner, res.children, extend);
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - start;
+    res.seconds += dt.count();
+  }
+  res.growth = double(res.children.size()) / sample.size();
+  res.seconds /= sample.size();
+  return res;
+}
+
+// If `order` is empty, picks the corners greedily from `corners`
+static Plan plan(
+    const SofaContext &ctx,
+    const Json::Value &angles,
+    std::vector<int> corners,
+    const std::vector<int> &order,
+    int layers, int samples, std::mt19937 &rng) {
+  SofaBranchTree t(ctx);
+  std::vector<SofaState> frontier(t.valid_states());
+  // Number of actual states each state in `frontier` stands for
+  double weight = 1;
+  Plan res;
+
+  size_t num_corners = corners.size();
+  for (size_t k = 0; k < num_corners; k++) {
+    if (frontier.empty())
+      break;
+
+    std::vector<size_t> all(frontier.size()), sample;
+    for (size_t i = 0; i < all.size(); i++)
+      all[i] = i;
+    std::sample(all.begin(), all.end(), std::back_inserter(sample),
+                samples, rng);
+
+    std::vector<int> choices = order.empty() ?
+      corners : std::vector<int>{order[k]};
+    int best = -1;
+    Probe best_probe;
+    for (auto c : choices) {
+      auto p = probe(frontier, sample, c, angles[c - 1]["extend"].asBool());
+      std::cout << "  corner " << c << ": growth " << p.growth
+                << ", " << p.seconds << "s per state" << std::endl;
+      if (best < 0 || p.growth < best_probe.growth ||
+          (p.growth == best_probe.growth && p.seconds < best_probe.seconds)) {
+        best = c;
+        best_probe = std::move(p);
+      }
+    }
+    corners.erase(std::find(corners.begin(), corners.end(), best));
+
+    double states = weight * frontier.size();
+    res.steps.push_back({
+        best, states * best_probe.growth, states * best_probe.seconds});
+    std::cout << "Corner " << best << ": ~" << res.steps.back().states
+              << " states" << std::endl;
+
+    std::vector<SofaState> next;
+    if (int(k) < layers && sample.size() < frontier.size()) {
+      // Grow the whole frontier
+      bool extend = angles[best - 1]["extend"].asBool();
+      for (const auto &s : frontier) {
+        SofaState cur(s);
+        add_corner(cur, best, next, extend);
+      }
+    } else {
+      // Keep the sampled children only
+      weight *= double(frontier.size()) / sample.size();
+      next.swap(best_probe.children);
+    }
+    frontier.swap(next);
+  }
+  return res;
+}
+
+int main(int argc, char* argv[]) {
+  try {
+    if (argc < 3) {
+      std::cout << "Usage: " << argv[0]
+                << " <angles.json> <out.json> [layers] [samples] [seed]"
+                << std::endl;
+      return 1;
+    }
+    int layers = argc > 3 ? std::stoi(argv[3]) : 2;
+    int samples = argc > 4 ? std::stoi(argv[4]) : 64;
+    int seed = argc > 5 ? std::stoi(argv[5]) : 0;
+
+    std::ifstream inp(argv[1]);
+    Json::Value angles;
+    inp >> angles;
+    if (angles.type() != Json::arrayValue)
+      throw std::invalid_argument("JSON not an array");
+
+    // Corners to branch on, in the given order
+    std::vector< std::pair<int, int> > order_pair;
+    for (int i = 0; i < int(angles.size()); i++) {
+      int order = angles[i]["branch_order"].asInt();
+      if (order >= 0)
+        order_pair.emplace_back(order, i + 1);
+    }
+    std::sort(order_pair.begin(), order_pair.end());
+    std::vector<int> given;
+    for (const auto &p : order_pair)
+      given.push_back(p.second);
+
+    SofaContext ctx(angles);
+    std::mt19937 rng(seed);
+
+    std::cout << "Estimating the given order" << std::endl;
+    Plan given_plan = plan(ctx, angles, given, given, layers, samples, rng);
+    std::cout << "Planning a greedy order" << std::endl;
+    Plan greedy_plan = plan(ctx, angles, given, {}, layers, samples, rng);
+
+    std::cout << "Given order: ~" << given_plan.seconds() << "s" << std::endl;
+    std::cout << "Greedy order: ~" << greedy_plan.seconds() << "s" << std::endl;
+    const Plan &best = greedy_plan.seconds() < given_plan.seconds() ?
+      greedy_plan : given_plan;
+
+    for (auto &angle : angles) {
+      angle.removeMember("estimated_states");
+      angle.removeMember("estimated_seconds");
+      if (angle["branch_order"].asInt() >= 0)
+        angle["branch_order"] = -1;
+    }
+    for (int k = 0; k < int(best.steps.size()); k++) {
+      auto &angle = angles[best.steps[k].corner - 1];
+      angle["branch_order"] = k;
+      angle["estimated_states"] = best.steps[k].states;
+      angle["estimated_seconds"] = best.steps[k].seconds;
+    }
+    // Corners never reached as every state died
+    int k = int(best.steps.size());
+    for (auto c : given)
+      if (angles[c - 1]["branch_order"].asInt() < 0)
+        angles[c - 1]["branch_order"] = k++;
+
+    std::ofstream out(argv[2]);
+    out << angles;
+  } catch(std::exception& e) {
+    std::cerr << "error: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
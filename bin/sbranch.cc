@@ -12,11 +12,18 @@ namespace po = boost::program_options;
 #include <algorithm>
 #include <utility>
 #include <filesystem>
+#include <memory>
+
+#include <unistd.h>
 
 #include "sofa/context.h"
 #include "sofa/geom.h"
 #include "sofa/branch_tree.h"
 #include "sofa/cereal.h"
+#include "sofa/estimate.h"
+#include "sofa/coordinator.h"
+#include "sofa/layers.h"
+#include "sofa/thread_pool.h"
 
 static bool endsWith(const std::string& str, const std::string& suffix) {
     return str.size() >= suffix.size() && 0 ==
@@ -33,54 +40,227 @@ QT rational(const std::string &s) {
   return res;
 }
 
-void process_angles(
-    Json::Value &angles,
-    unsigned int nthreads,
-    const std::string &out,
-    bool json_output,
-    bool show_max_area) {
+struct Config {
+  std::string out;
+  unsigned int nthreads;
+  bool pin_threads;
+  bool json_output;
+  bool show_max_area;
+  bool best_first;
+  bool dedupe;
+  bool symmetric;
+  bool bisect;
+  int estimate_samples;
+  // If positive, corners are pipelined with this many states in flight
+  size_t pipeline;
+  // If positive, leaves beyond this many megabytes are spilled to disk
+  size_t memory_budget;
+  // If set, the tree after each corner is written to <out>.layers/
+  bool checkpoint;
+  // If nonempty, restart from the layers of this previous tree
+  std::string reuse;
+  // Number of corners in the prefix shared by shards, or -1
+  int prefix;
+  // If positive, write this many shards of the prefix tree and stop
+  int shards;
+  // If nonnegative, continue the shard `shard` out of `num_shards`
+  int shard, num_shards;
+  // Tree the shards are cut from
+  std::string in;
+  // If positive, corners after the prefix are added by worker processes
+  int workers;
+  size_t task_size;
+  std::string work_dir;
+};
+
+// Path of the i'th out of n shards of `path`: tree.crl -> tree.2of8.crl
+static std::string shard_path(const std::string &path, int i, int n) {
+  std::filesystem::path fp(path);
+  std::string ext = fp.extension().string();
+  fp.replace_extension(
+      "." + std::to_string(i) + "of" + std::to_string(n) + ext);
+  return fp.string();
+}
+
+// Options changing the tree after a given prefix of corners
+static Json::Value tree_options(const Config &cfg) {
+  Json::Value res(Json::objectValue);
+  res["dedupe"] = cfg.dedupe;
+  res["bisect"] = cfg.bisect;
+  res["symmetric"] = cfg.symmetric;
+  return res;
+}
+
+void process_angles(Json::Value &angles, const Config &cfg) {
   if (angles.type() != Json::arrayValue)
     throw std::invalid_argument("JSON not an array");
 
-  std::vector< std::pair<int, int> > order_pair;
+  auto corners = branch_corners(angles);
 
-  for (int i = 0; i < angles.size(); i++) {
-    const auto &angle = angles[i];
-    int order = angle["branch_order"].asInt();
-    if (order < 0)
-      continue;
-    order_pair.emplace_back(order, i + 1);
-  }
-
-  // Determine the corner indices in branching order
-  std::sort(order_pair.begin(), order_pair.end());
-  std::vector<int> bidx(order_pair.size());
-  for (size_t i = 0; i < order_pair.size(); i++)
-    bidx[i] = order_pair[i].second;
+  if (cfg.prefix > int(corners.size()))
+    throw std::invalid_argument("Prefix longer than the branching order");
 
   // Branching
   SofaContext ctx(angles);
-  SofaBranchTree t(ctx);
-  for (auto i : bidx) {
-    t.add_corner(i, angles[i - 1]["extend"].asBool(), nthreads);
+  std::unique_ptr<SofaBranchTree> tp;
+  // Number of corners taken from a previous tree
+  size_t reused = 0;
+  if (cfg.shard >= 0) {
+    // Continue a shard of the prefix tree
+    std::string in = shard_path(cfg.in, cfg.shard, cfg.num_shards);
+    std::cout << "Reading shard from: " << in << std::endl;
+    CerealReader reader(in.c_str());
+    if (!reader)
+      throw std::invalid_argument("Cannot open shard " + in);
+    if (SofaContext(reader) != ctx)
+      throw std::invalid_argument("Shard built from different angles");
+    tp = std::make_unique<SofaBranchTree>(ctx, reader, false);
+    reader.close();
+    corners.erase(corners.begin(), corners.begin() + cfg.prefix);
+  } else {
+    if (!cfg.reuse.empty()) {
+      reused = reusable_prefix(cfg.reuse, angles, tree_options(cfg));
+      if (reused == 0)
+        std::cout << "No layers of " << cfg.reuse
+                  << " from the same angles and options" << std::endl;
+    }
+    if (reused > 0) {
+      std::string in = layer_path(cfg.reuse, reused);
+      std::cout << "Reusing " << reused << " corners from: " << in << std::endl;
+      CerealReader reader(in.c_str());
+      if (SofaContext(reader) != ctx)
+        throw std::invalid_argument("Layer built from different angles");
+      tp = std::make_unique<SofaBranchTree>(ctx, reader, false);
+      reader.close();
+      corners.erase(corners.begin(), corners.begin() + reused);
+    } else {
+      tp = std::make_unique<SofaBranchTree>(ctx);
+    }
+    if (cfg.shards > 0)
+      corners.resize(cfg.prefix);
+  }
+  SofaBranchTree &t = *tp;
+  t.dedupe(cfg.dedupe);
+  t.bisect(cfg.bisect);
+  if (cfg.memory_budget > 0)
+    t.memory_budget(cfg.memory_budget << 20, cfg.work_dir);
+  if (cfg.symmetric) {
+    if (!ctx.is_symmetric())
+      throw std::invalid_argument("--symmetric requires symmetric angles");
+    // A shard or a reused layer has it already
+    if (cfg.shard < 0 && reused == 0)
+      t.break_symmetry();
   }
 
-  if (show_max_area) {
-    // Print relevant information
-    QT marea(0);
-    auto x(t.valid_states());
-    for (auto &s : x) {
-      auto a = s.area();
-      marea = std::max(marea, a);
+  std::string out = cfg.shard >= 0 ?
+    shard_path(cfg.out, cfg.shard, cfg.num_shards) : cfg.out;
+  std::filesystem::path fp(out);
+  if (cfg.json_output && !out.empty() &&
+      cfg.estimate_samples == 0 && !cfg.best_first) {
+    if (std::filesystem::exists(fp)) {
+      std::cout << "Warning: the output directory already exists!" << std::endl;
     }
-    std::cout << "Number of valid states: " << t.valid_states().size() << std::endl;
+    std::filesystem::create_directory(fp);
+    // Splits and dead states go to disk as they are found
+    t.record_to((fp / std::filesystem::path("journal.crl")).string());
+  }
+
+  if (cfg.estimate_samples > 0) {
+    auto est = estimate_tree(t, corners, cfg.estimate_samples);
+    std::cout << "Estimates with 95% confidence intervals" << std::endl;
+    double total = 0, total_err = 0;
+    for (const auto &e : est) {
+      std::cout << "Corner " << e.corner << ": "
+        << e.states.mean << " +- " << e.states.err << " states, "
+        << e.qps.mean << " +- " << e.qps.err << " QPs, "
+        << e.seconds.mean << " +- " << e.seconds.err << "s" << std::endl;
+      total += e.seconds.mean;
+      total_err += e.seconds.err;
+    }
+    std::cout << "Total time: " << total << " +- " << total_err << "s "
+      << "on a single thread" << std::endl;
+    return;
+  }
+
+  if (cfg.best_first) {
+    auto marea = t.max_area_best_first(corners);
+    std::cout << "Number of open states: " << t.valid_states().size() << std::endl;
     std::cout << "Area: " << marea << std::endl;
+    return;
+  }
+
+  if (cfg.workers > 0) {
+    // Only the prefix is branched here, unless a shard is continued
+    int prefix = cfg.shard >= 0 ? 0 : cfg.prefix;
+    for (int k = 0; k < prefix; k++)
+      t.add_corner(corners[k].first, corners[k].second, cfg.nthreads);
+    corners.erase(corners.begin(), corners.begin() + prefix);
+
+    size_t task_size = cfg.task_size;
+    if (task_size == 0) {
+      // A few tasks per worker, for balance
+      task_size = t.valid_states().size() / (8 * cfg.workers);
+      task_size = std::max(task_size, size_t(1));
+    }
+    add_corners_with_workers(t, corners, cfg.workers, task_size, cfg.work_dir);
+    // Remove the work directory if nothing else is in it
+    std::error_code ec;
+    std::filesystem::remove(cfg.work_dir, ec);
+  } else if (cfg.pipeline > 0) {
+    t.add_corners(corners, cfg.nthreads, cfg.pipeline);
+  } else {
+    if (cfg.checkpoint)
+      start_layers(cfg.out, cfg.reuse, angles, tree_options(cfg), reused);
+    for (size_t k = 0; k < corners.size(); k++) {
+      t.add_corner(corners[k].first, corners[k].second, cfg.nthreads);
+      // The last layer too, as the output may be overwritten by
+      // a later run without layers
+      if (cfg.checkpoint)
+        write_layer(cfg.out, reused + k + 1, t);
+    }
   }
 
-  if (out.empty())
+  if (cfg.shards > 0) {
+    t.gather();
+    // Deal the states of the prefix tree to the shards
+    const auto &states = t.valid_states();
+    for (int i = 0; i < cfg.shards; i++) {
+      std::vector<SofaState> shard;
+      for (size_t j = i; j < states.size(); j += cfg.shards)
+        shard.push_back(states[j]);
+      std::string path = shard_path(cfg.out, i, cfg.shards);
+      std::cout << "Shard " << path << ": "
+                << shard.size() << " states" << std::endl;
+      // Same format as a whole tree
+      CerealWriter writer(path.c_str());
+      writer << ctx << shard;
+      writer.close();
+    }
     return;
+  }
 
-  if (!json_output) {
+  if (cfg.show_max_area) {
+    // Print relevant information
+    auto best = t.max_area();
+    std::cout << "Number of valid states: " << t.valid_states().size() << std::endl;
+    std::cout << "Area: " << best.area << std::endl;
+    if (best.id >= 0) {
+      std::cout << "Attained by state " << best.id << " with niche";
+      for (auto ee : best.e)
+        std::cout << " " << ee;
+      std::cout << std::endl;
+    }
+    if (cfg.json_output && !out.empty()) {
+      std::ofstream max_area_f(fp / std::filesystem::path("max-area.json"));
+      max_area_f << best.json();
+      max_area_f.close();
+    }
+  }
+
+  if (cfg.out.empty())
+    return;
+
+  if (!cfg.json_output) {
     // use cerealization
     CerealWriter writer(out.c_str());
     writer << ctx << t;
@@ -89,14 +269,7 @@ void process_angles(
   }
 
   // json output
-  std::filesystem::path fp(out);
-
-  if (std::filesystem::exists(fp)) {
-    std::cout << "Warning: the output directory already exists!" << std::endl;
-  }
-
-  std::filesystem::create_directory(fp);
-
+  t.gather();
   // Write the files
   {
     std::ofstream angles_f(fp / std::filesystem::path("angles.json"));
@@ -125,22 +298,66 @@ void process_angles(
 
 int main(int argc, char* argv[]) {
   try {
-    std::string angles, out;
-    unsigned int nthreads = 1;
+    std::string angles, shard;
+    Config cfg;
+    cfg.nthreads = 1;
+    cfg.estimate_samples = 0;
 
     // Set up syntax for arguments
     po::options_description desc("Allowed options");
     desc.add_options()
       ("help", "Produce help message")
       ("angles", po::value<std::string>(&angles), "Required angle partition")
-      ("out", po::value<std::string>(&out)->implicit_value(""),
+      ("out", po::value<std::string>(&cfg.out)->implicit_value(""),
         "File/directory for output (optional)\n")
       ("json", "For output to be json")
-      ("nthreads", po::value<unsigned int>(&nthreads)->implicit_value(1),
+      ("nthreads", po::value<unsigned int>(&cfg.nthreads)->implicit_value(1),
         "Number of threads to use (optional)\n"
         "Note that the output is not deterministic "
         "when the option is specified")
+      ("pin-threads", "Pins the threads to cores, one NUMA node after another, "
+        "so that the states of a thread stay in memory of its node (Linux)")
       ("show-max-area", "Computes maximum area (takes more time)")
+      ("best-first", "Computes maximum area only, by best-first search\n"
+        "Stops once the bound is certified and writes no output")
+      ("estimate", po::value<int>(&cfg.estimate_samples)->implicit_value(1000),
+        "Estimates the size and running time of the tree "
+        "from the given number of sampled paths, without branching")
+      ("dedupe", "Solves the area QP once per niche and constraint set, "
+        "and keeps one leaf out of leaves with the same ones")
+      ("bisect", "Locates each corner on the niche by bisection, "
+        "giving shallower trees with fewer constraints per leaf")
+      ("symmetric", "Branches only one out of each sofa and its reflection, "
+        "for angles symmetric under swapping cos and sin")
+      ("pipeline", po::value<size_t>(&cfg.pipeline)
+        ->default_value(0)->implicit_value(65536),
+        "Starts the next corner of a state without waiting for the others, "
+        "with at most this many states between the first and last corner")
+      ("memory-budget", po::value<size_t>(&cfg.memory_budget)
+        ->default_value(0),
+        "Megabytes of leaves kept in memory; the rest are spilled to "
+        "sorted chunks in the work directory (optional)")
+      ("checkpoint", "Also writes the tree after each corner "
+        "to <out>.layers/ for --reuse")
+      ("reuse", po::value<std::string>(&cfg.reuse),
+        "Previous tree written with --checkpoint; branching restarts from "
+        "its layer after the longest common prefix of corners")
+      ("prefix", po::value<int>(&cfg.prefix)->default_value(-1),
+        "Number of corners in the prefix tree shared by shards")
+      ("shards", po::value<int>(&cfg.shards)->default_value(0),
+        "Writes the prefix tree to this many shards <out>.<i>of<N>.crl")
+      ("shard", po::value<std::string>(&shard),
+        "Continues shard i/N of the prefix tree <in> "
+        "and writes it to <out>.<i>of<N>.crl")
+      ("in", po::value<std::string>(&cfg.in),
+        "Tree the shards were written from")
+      ("workers", po::value<int>(&cfg.workers)->default_value(0),
+        "Number of worker processes adding the corners after the prefix")
+      ("task-size", po::value<size_t>(&cfg.task_size)->default_value(0),
+        "Number of states handed to a worker at once (optional)")
+      ("work-dir", po::value<std::string>(&cfg.work_dir),
+        "Directory for the states passed to and from workers, "
+        "or spilled under --memory-budget (optional)")
       ;
 
     po::positional_options_description p;
@@ -152,8 +369,14 @@ int main(int argc, char* argv[]) {
               options(desc).positional(p).run(), vm);
     po::notify(vm);
 
-    bool json_output = vm.count("json");
-    bool show_max_area = vm.count("show-max-area");
+    cfg.json_output = vm.count("json");
+    cfg.show_max_area = vm.count("show-max-area");
+    cfg.best_first = vm.count("best-first");
+    cfg.dedupe = vm.count("dedupe");
+    cfg.symmetric = vm.count("symmetric");
+    cfg.bisect = vm.count("bisect");
+    cfg.checkpoint = vm.count("checkpoint");
+    cfg.pin_threads = vm.count("pin-threads");
 
     // Logic
     if (vm.count("help")) {
@@ -161,6 +384,52 @@ int main(int argc, char* argv[]) {
       return 0;
     }
 
+    if ((cfg.best_first || cfg.estimate_samples > 0) && !cfg.out.empty())
+      throw std::invalid_argument(
+          "--best-first and --estimate do not build the full tree for --out");
+
+    cfg.shard = cfg.num_shards = -1;
+    if (!shard.empty()) {
+      char slash;
+      std::stringstream sin(shard);
+      sin >> cfg.shard >> slash >> cfg.num_shards;
+      if (!sin || slash != '/' || !sin.eof() ||
+          cfg.shard < 0 || cfg.shard >= cfg.num_shards)
+        throw std::invalid_argument("Invalid shard: " + shard);
+      if (cfg.in.empty())
+        throw std::invalid_argument("--shard requires --in");
+    }
+    if ((cfg.shards > 0 || cfg.shard >= 0) && cfg.prefix < 0)
+      throw std::invalid_argument("Sharding requires --prefix");
+    if (cfg.shards > 0 && (cfg.out.empty() || cfg.json_output))
+      throw std::invalid_argument("--shards requires a cereal --out");
+    if (cfg.workers > 0 && (cfg.shards > 0 || cfg.best_first ||
+                            cfg.estimate_samples > 0))
+      throw std::invalid_argument(
+          "--workers only applies to a full run or a shard");
+    if (cfg.workers > 0 && cfg.json_output)
+      throw std::invalid_argument("--workers requires a cereal --out");
+    if (cfg.pipeline > 0 && cfg.workers > 0)
+      throw std::invalid_argument("--pipeline does not apply to --workers");
+    if (cfg.checkpoint && (cfg.out.empty() || cfg.json_output ||
+                           cfg.shards > 0 || !shard.empty() ||
+                           cfg.workers > 0 || cfg.pipeline > 0))
+      throw std::invalid_argument(
+          "--checkpoint requires a cereal --out of a single-process run");
+    if (!cfg.reuse.empty() && (cfg.json_output ||
+                               cfg.shards > 0 || !shard.empty()))
+      throw std::invalid_argument(
+          "--reuse does not apply to --json or sharding");
+    if (cfg.memory_budget > 0 && (cfg.pipeline > 0 || cfg.workers > 0))
+      throw std::invalid_argument(
+          "--memory-budget does not apply to --pipeline or --workers");
+    if (cfg.prefix < 0)
+      cfg.prefix = cfg.workers > 0 ? 1 : 0;
+    if (cfg.work_dir.empty()) {
+      cfg.work_dir = (std::filesystem::temp_directory_path() /
+        ("sbranch-" + std::to_string(getpid()))).string();
+    }
+
     const std::string ext(".json");
     if (!vm.count("angles")) {
       throw std::invalid_argument("Angles missing");
@@ -172,7 +441,13 @@ int main(int argc, char* argv[]) {
     std::ifstream inp(angles);
     Json::Value angles_json;
     inp >> angles_json;
-    process_angles(angles_json, nthreads, out, json_output, show_max_area);
+    set_num_threads(cfg.nthreads, cfg.pin_threads);
+    process_angles(angles_json, cfg);
+    if (cfg.memory_budget > 0) {
+      // Remove the work directory if nothing else is in it
+      std::error_code ec;
+      std::filesystem::remove(cfg.work_dir, ec);
+    }
   } catch(std::exception& e) {
     std::cerr << "error: " << e.what() << "\n";
     return 1;
@@ -1,6 +1,7 @@
 #include <boost/program_options.hpp>
 namespace po = boost::program_options;
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <iterator>
@@ -10,17 +11,18 @@ namespace po = boost::program_options;
 #include <string>
 #include <vector>
 #include <stdexcept>
-#include <shared_mutex>
-#include <thread>
-#include <future>
 
 #include "sofa/context.h"
 #include "sofa/geom.h"
 #include "sofa/branch_tree.h"
 #include "sofa/json.h"
 #include "sofa/cereal.h"
-#include "parse.h"
-#include "tqdm.h"
+#include "sofa/thread_pool.h"
+#include "sofa/tree_index.h"
+#include "sofa/leaf_cache.h"
+#include "sofa/query.h"
+#include "sofa/server.h"
+#include "sofa/parse.h"
 
 struct Config {
   std::string tree_file_path;
@@ -30,10 +32,19 @@ struct Config {
   int nthreads;
   bool find_lb, find_ub;
   std::string json_export_path;
+  bool exact;
+  // Answer queries from the standard input until it ends
+  bool serve;
+  // Append an index of the leaves to the tree file first
+  bool build_index;
+  // Reuse and keep bounds of the leaves in <tree>.cache
+  bool use_cache;
+  // If nonempty, a JSON file of queries to answer instead of `linear_form`
+  std::string queries_path;
 };
 
 Config parse_config(int argc, char* argv[]) {
-  std::string tree, value, min_str, max_str, json_out;
+  std::string tree, value, min_str, max_str, json_out, queries;
   int nthreads, bsearch_depth;
 
   // Set up syntax for arguments
@@ -52,6 +63,31 @@ Config parse_config(int argc, char* argv[]) {
       "Number of threads to use (optional)\n")
     ("bsearch-depth", po::value<int>(&bsearch_depth)->default_value(5),
       "Depth of binary search (optional)\n")
+    ("exact", "Bounds each leaf by Lagrangian relaxation instead of "
+      "binary search, finding both bounds in one pass. "
+      "Stops refining a leaf once its bound is within the precision of "
+      "--bsearch-depth of a sofa attaining it\n")
+    ("queries", po::value<std::string>(&queries),
+      "JSON file of queries {\"value\", \"bound\": \"lb\" or \"ub\", "
+      "\"min\", \"max\"} answered over one reading of the tree, "
+      "instead of value, min and max. "
+      "Results go to queries.json in the --json directory, "
+      "or to the standard output\n")
+    ("serve", "Keep the tree loaded and answer queries line by line "
+      "from the standard input, one JSON reply per line:\n"
+      "  lb|ub MIN MAX VALUE\n"
+      "  compatible INEQ\n"
+      "  set exact on|off, set bsearch-depth N\n"
+      "  quit\n"
+      "Bounds of the leaves are kept between queries\n")
+    ("build-index", "Append to the tree file proven bounds of each variable "
+      "and of the forms of value and --queries over each leaf, "
+      "to --bsearch-depth precision. "
+      "Later runs skip the QPs of leaves these bounds already settle\n")
+    ("cache", "Read and write <tree>.cache, the best proven bound of each "
+      "leaf and form found so far with --exact. Later runs on the same tree "
+      "check the certificate of a bound with one QP and skip the leaves "
+      "it settles. A server writes it when it quits\n")
     ;
 
   po::positional_options_description p;
@@ -71,148 +107,200 @@ Config parse_config(int argc, char* argv[]) {
     std::cout << desc << "\n";
     std::exit(0);
   }
+  check_bsearch_depth(bsearch_depth);
+
+  // Bounds come with each query in a batch or a server
+  QT bound_min, bound_max;
+  if (queries.empty() && !vm.count("serve") && !value.empty()) {
+    bound_min = QT(min_str);
+    bound_max = QT(max_str);
+  }
 
   return Config{
-    tree, value, QT(min_str), QT(max_str),
+    tree, value, bound_min, bound_max,
     bsearch_depth, nthreads,
     vm.count("lb") > 0, vm.count("ub") > 0,
-    json_out
+    json_out,
+    vm.count("exact") > 0,
+    vm.count("serve") > 0,
+    vm.count("build-index") > 0,
+    vm.count("cache") > 0,
+    queries
   };
 }
 
-// if false, we are searching for upper bound
-bool searching_lb;
-
-bool report_incompatible(
-    const SofaState &v,
-    const LinearForm &val,
-    const QT &lb) {
-  // Proof by contradiction
-  auto res = v.is_compatible(searching_lb ? val <= lb : val >= lb);
-  if (!res) {
-    return true;
-  } else {
-    return false;
-  }
+// How the leaves are bounded for the queries of `cfg`
+QueryOptions query_options(const Config &cfg) {
+  // The progress bar would mix with the replies of a server
+  return {cfg.exact, cfg.bsearch_depth, cfg.nthreads, !cfg.serve};
 }
 
-std::shared_mutex mutex;
-QT res, res_min, res_max;
-int bsearch_depth;
-
-void bsearch_worker(
-    int worker_id, int num_workers,
-    const std::vector<SofaState> &nodes, 
-    const LinearForm &val) {
-  tqdm *bar = worker_id ? nullptr : new tqdm();
-  int c = 0, n = (int(nodes.size()) - 1) / num_workers + 1;
-  for (int i = worker_id; i < nodes.size(); i += num_workers) {
-    const auto &v = nodes[i];
-    if (bar)
-      bar->progress(c++, n);
-
-    mutex.lock_shared();
-    if (bar)
-      bar->set_label(to_json(res).asString());
-    
-    if (!report_incompatible(v, val, res)) {
-      mutex.unlock_shared();
-      mutex.lock();
-      if (!report_incompatible(v, val, res)) {
-        bool res_found = false;
-        QT clb = res_min, cub = res_max;
-        for (int i = 0; i < bsearch_depth; i++) {
-          QT md = (clb + cub) / 2;
-          if (report_incompatible(v, val, md)) {
-            res_found = true;
-            searching_lb ? clb = md : cub = md;
-          } else {
-            searching_lb ? cub = md : clb = md;
-          }
-        }
-        // TODO: send this error to root thread
-        if (!res_found) {
-          std::cout << "Bound invalid" << std::endl;
-          throw std::runtime_error("Bound invalid");
-        } if (searching_lb) {
-          expect(res > clb);
-          res = clb;
-        } else {
-          expect(res < cub);
-          res = cub;
-        }
-      }
-      mutex.unlock();
-    }
-    else
-      mutex.unlock_shared();
-  }
-  if (bar)
-    bar->finish();
-}
+// Queries of the file at `path`
+std::vector<Query> read_queries(const std::string &path, Parser &parser) {
+  std::ifstream in(path);
+  if (!in)
+    throw std::invalid_argument("Cannot open queries " + path);
+  Json::Value doc;
+  in >> doc;
+  if (doc.type() != Json::arrayValue)
+    throw std::invalid_argument("Queries not an array");
 
-void bsearch(
-    const SofaBranchTree &tree, 
-    const LinearForm &val,
-    const Config &config) {
-  res_min = config.bound_min;
-  res_max = config.bound_max;
-  bsearch_depth = config.bsearch_depth;
-
-  const auto &nodes = tree.valid_states();
-
-  if (config.find_lb) {
-    searching_lb = true;
-    res = res_max;
-
-    std::future<void> futures[config.nthreads];
-    for (int i = 0; i < config.nthreads; i++)
-      futures[i] = std::async(bsearch_worker, i, config.nthreads, nodes, val);
-    for (auto &f : futures)
-      f.get();
-    
-    std::cout <<
-      "Lower bound of " << config.linear_form << ": " << 
-      to_json(res).asString() << std::endl;
+  std::vector<Query> queries;
+  for (const auto &q : doc) {
+    auto bound = q["bound"].asString();
+    if (bound != "lb" && bound != "ub")
+      throw std::invalid_argument("Query bound should be lb or ub");
+    auto expr = q["value"].asString();
+    queries.push_back({expr, parser.parse_expr(expr), bound == "lb",
+                       stoq(q["min"].asString()), stoq(q["max"].asString())});
   }
+  return queries;
+}
 
-  if (config.find_ub) {
-    searching_lb = false;
-    res = res_min;
-
-    std::future<void> futures[config.nthreads];
-    for (int i = 0; i < config.nthreads; i++)
-      futures[i] = std::async(bsearch_worker, i, config.nthreads, nodes, val);
-    for (auto &f : futures)
-      f.get();
-    
-    std::cout <<
-      "Upper bound of " << config.linear_form << ": " << 
-      to_json(res).asString() << std::endl;
-  }
+// Answers the queries of the standard input in the protocol of --serve,
+// until it ends or reads `quit`
+void serve(
+    const SofaBranchTree &tree, bool mirrored, const TreeIndex *index,
+    LeafCache &cache, const QueryOptions &options) {
+  QueryServer server(tree, mirrored, index, cache, options);
+  server.serve(std::cin, std::cout);
 }
 
 void run(const Config &cfg) {
-  std::cout << "Reading tree from: " << cfg.tree_file_path << std::endl;
+  // The standard output of a server is for its replies
+  std::ostream &log = cfg.serve ? std::cerr : std::cout;
+  log << "Reading tree from: " << cfg.tree_file_path << std::endl;
 
   CerealReader reader(cfg.tree_file_path.c_str());
   SofaContext ctx(reader);
-  SofaBranchTree tree(ctx, reader);
+  // The progress bar would come before the first reply of a server
+  SofaBranchTree tree(ctx, reader, true, !cfg.serve);
+  size_t tree_end = size_t(reader.tellg());
+  auto index = read_index(reader);
   reader.close();
-  std::cout << "Reading tree done." << std::endl;
+  log << "Reading tree done." << std::endl;
+  if (index && index->num_leaves() != tree.valid_states().size()) {
+    log << "Index does not match the tree, ignored" << std::endl;
+    index.reset();
+  }
+
+  bool mirrored = is_symmetry_broken(tree);
+  if (mirrored)
+    log << "Leaves cover sofas up to reflection" << std::endl;
 
   Parser parser(ctx);
+  if (cfg.build_index) {
+    // The forms to query are bounded as they are
+    std::vector<LinearForm> directions;
+    if (!cfg.linear_form.empty())
+      directions.push_back(parser.parse_expr(cfg.linear_form));
+    if (!cfg.queries_path.empty())
+      for (const auto &q : read_queries(cfg.queries_path, parser))
+        directions.push_back(q.val);
+    if (mirrored)
+      for (size_t k = 0, n = directions.size(); k < n; k++)
+        directions.push_back(ctx.mirror_form(directions[k]));
+    for (size_t k = 0, n = directions.size(); k < n; k++)
+      directions.push_back(-directions[k]);
+
+    log << "Building index" << std::endl;
+    QT tol = QT(1) / QT(NT(1) << cfg.bsearch_depth);
+    index = TreeIndex::build(
+        tree, directions, tol, 2 * cfg.bsearch_depth + 2);
+    write_index(cfg.tree_file_path.c_str(), tree_end, *index);
+    log << "Index written to " << cfg.tree_file_path << std::endl;
+    if (cfg.linear_form.empty() && cfg.queries_path.empty() && !cfg.serve)
+      return;
+  }
+  const TreeIndex *index_ptr = index ? &*index : nullptr;
+
+  // Bounds of the leaves of earlier runs on the same tree
+  LeafCache cache;
+  std::string cache_path = cfg.tree_file_path + ".cache";
+  std::string hash;
+  if (cfg.use_cache) {
+    hash = file_hash(cfg.tree_file_path, tree_end);
+    cache.load(cache_path, hash);
+  }
+  auto save_cache = [&]() {
+    if (cfg.use_cache) {
+      cache.save(cache_path, hash);
+      log << "Bounds of the leaves kept in " << cache_path << std::endl;
+    }
+  };
+
+  if (cfg.serve) {
+    serve(tree, mirrored, index_ptr, cache, query_options(cfg));
+    save_cache();
+    return;
+  }
+
+  if (!cfg.queries_path.empty()) {
+    auto queries = read_queries(cfg.queries_path, parser);
+    auto results = answer(
+        tree, mirrored, index_ptr, queries, query_options(cfg),
+        cfg.use_cache ? &cache : nullptr);
+    save_cache();
+    Json::Value table(Json::arrayValue);
+    for (size_t k = 0; k < queries.size(); k++) {
+      table.append(results[k].json(queries[k]));
+      if (!cfg.json_export_path.empty() && cfg.exact)
+        table[int(k)]["leaves"] = results[k].certificates;
+    }
+    if (cfg.json_export_path.empty()) {
+      std::cout << table << std::endl;
+    } else {
+      std::filesystem::create_directories(cfg.json_export_path);
+      std::ofstream out(
+          std::filesystem::path(cfg.json_export_path) / "queries.json");
+      out << table;
+    }
+    return;
+  }
+
   LinearForm val = parser.parse_expr(cfg.linear_form);
+  std::vector<Query> queries;
+  if (cfg.find_lb)
+    queries.push_back(
+        {cfg.linear_form, val, true, cfg.bound_min, cfg.bound_max});
+  if (cfg.find_ub)
+    queries.push_back(
+        {cfg.linear_form, val, false, cfg.bound_min, cfg.bound_max});
+  auto results = answer(
+      tree, mirrored, index_ptr, queries, query_options(cfg),
+      cfg.use_cache ? &cache : nullptr);
+  save_cache();
 
-  bsearch(tree, val, cfg);
+  for (size_t k = 0; k < queries.size(); k++) {
+    bool lb = queries[k].lb;
+    const auto &r = results[k];
+    if (r.error)
+      throw std::runtime_error(*r.error);
+    std::cout <<
+      (lb ? "Lower" : "Upper") << " bound of " << cfg.linear_form << ": " <<
+      to_json(r.bound).asString() << std::endl;
+    if (r.witness)
+      std::cout << "Attained up to " << 
+        to_json(lb ? *r.witness - r.bound : r.bound - *r.witness).asString() <<
+        " by a sofa with value " << to_json(*r.witness).asString() << std::endl;
 
-  // TODO: json output functionality
+    if (!cfg.json_export_path.empty() && cfg.exact) {
+      std::filesystem::create_directories(cfg.json_export_path);
+      std::ofstream out(std::filesystem::path(cfg.json_export_path) /
+                        (lb ? "lower-bound.json" : "upper-bound.json"));
+      Json::Value doc(Json::objectValue);
+      doc["bound"] = to_json(r.bound);
+      doc["leaves"] = r.certificates;
+      out << doc;
+    }
+  }
 }
 
 int main(int argc, char* argv[]) {
   try {
 
     Config cfg = parse_config(argc, argv);
+    set_num_threads(cfg.nthreads);
     run(cfg);
 
   } catch(std::exception& e) {
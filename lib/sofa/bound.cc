@@ -0,0 +1,91 @@
+#include "bound.h"
+
+#include <utility>
+
+#include "json.h"
+#include "expect.h"
+
+Json::Value StateBound::json() const {
+  Json::Value res(Json::objectValue);
+  res["lower"] = to_json(lower);
+  res["t"] = to_json(t);
+  res["optimality_proof"] = proof.json();
+  if (witness)
+    res["witness"] = to_json(*witness);
+  res["num_qps"] = num_qps;
+  return res;
+}
+
+// Nearby multiplier with a short binary expansion, since every multiplier
+// gives a valid bound and long ones make the QP slower
+static QT short_multiplier(const QT &t, const QT &lo, const QT &hi) {
+  mpq_class q(mpq_class(t.numerator(), t.denominator()).get_d());
+  QT res(NT(q.get_num()), NT(q.get_den()));
+  return lo < res && res < hi ? res : t;
+}
+
+StateBound min_over_state(
+    const SofaState &s, const LinearForm &f,
+    const QT &tol, int max_qps, QT t) {
+  return min_over_state(s, s.qp_setup(), f, tol, max_qps, t);
+}
+
+StateBound min_over_state(
+    const SofaState &s, const SofaQPSetup &setup, const LinearForm &f,
+    const QT &tol, int max_qps, QT t) {
+  expect(max_qps > 0);
+  expect(t > 0);
+  const QT c(22195, 10000);
+  const auto &area = setup.area;
+
+  std::optional<StateBound> best;
+  std::optional<QT> witness;
+  // Last multipliers with the area of the maximizer above and below c,
+  // with the area minus c (halved when kept twice, as in Illinois)
+  std::optional< std::pair<QT, QT> > above, below;
+  int last_side = 0;
+  int k = 0;
+  while (k < max_qps) {
+    auto res = s.penalized_area(setup, f, t);
+    k++;
+    expect(res.is_optimal());
+    const auto &proof = res.optimality_proof();
+    QT lower = (c - proof.max_area) / t;
+    if (!best || lower > best->lower)
+      best = StateBound{lower, t, proof, std::nullopt, 0};
+
+    QT g = area(proof.maximizer) - c;
+    if (g >= 0) {
+      QT value = f(proof.maximizer);
+      if (!witness || value < *witness)
+        witness = value;
+      above = {t, g};
+      if (last_side > 0 && below)
+        below->second /= 2;
+      last_side = 1;
+    } else {
+      below = {t, g};
+      if (last_side < 0 && above)
+        above->second /= 2;
+      last_side = -1;
+    }
+    if (witness && *witness - best->lower <= tol)
+      break;
+
+    // A larger multiplier moves the maximizer to smaller areas
+    if (!below) {
+      t *= 4;
+    } else if (!above) {
+      t /= 4;
+    } else {
+      const auto &[t_a, g_a] = *above;
+      const auto &[t_b, g_b] = *below;
+      QT next = t_a + (t_b - t_a) * g_a / (g_a - g_b);
+      t = short_multiplier(next, std::min(t_a, t_b), std::max(t_a, t_b));
+    }
+  }
+
+  best->witness = witness;
+  best->num_qps = k;
+  return *best;
+}
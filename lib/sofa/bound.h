@@ -0,0 +1,38 @@
+#pragma once
+
+#include <optional>
+
+#include <json/json.h>
+
+#include "number.h"
+#include "forms.h"
+#include "qp.h"
+#include "state.h"
+
+// Lower bound of a linear form f over the sofas of a state
+// with area at least 2.2195, from the Lagrangian relaxation
+// max(area - t * f) = H  =>  f >= (2.2195 - H) / t
+struct StateBound {
+  QT lower;
+  // Multiplier and the maximum of `area - t * f` proving `lower`
+  QT t;
+  SofaAreaOptimalityProof proof;
+  // Smallest f found at a sofa of the state with area at least 2.2195,
+  // so that the minimum of f is in [lower, witness]
+  std::optional<QT> witness;
+  int num_qps;
+
+  Json::Value json() const;
+};
+
+// Lower bound of `f` over the state `s`, starting from the multiplier `t`.
+// Each QP gives a valid bound; the multiplier is moved towards the one
+// whose maximizer has area 2.2195, where the bound is tight,
+// until the bound is within `tol` of a witness or `max_qps` QPs are solved.
+StateBound min_over_state(
+    const SofaState &s, const LinearForm &f,
+    const QT &tol, int max_qps, QT t = QT(1));
+// Same as above, with the QP setup of `s`
+StateBound min_over_state(
+    const SofaState &s, const SofaQPSetup &setup, const LinearForm &f,
+    const QT &tol, int max_qps, QT t = QT(1));
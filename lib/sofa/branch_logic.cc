@@ -1,6 +1,16 @@
 #include "branch_logic.h"
 
+#include <utility>
+
 #include "expect.h"
+#include "branch_tree.h"
+
+// locating the corner p_i = p(i, i - n) by bisection
+void locate_corner(
+    SofaState &s, int i, int lo, int hi, Sink &sink, bool extend);
+// the corner p_i = p(i, i - n) is above the j'th edge
+void add_corner_at(
+    SofaState &cur, int i, int j, Sink &sink, bool extend);
 
 // case where point p_i = p(i, i - n) is inside triangular region
 void add_corner_inside(
@@ -38,34 +48,67 @@ void add_corner(SofaState &s, int i, Sink &sink, bool extend) {
     SofaState s_below = s.split(s.ctx.is_over(i - n, i, 0));
     if (s_below.is_valid()) {
       std::cout << "WARNING: Below valid" << std::endl;
-      sink.push_back(s_below);
+      sink.push_back(std::move(s_below));
     }
   }
   { // case when p(i, i - n) is over the line y = 0
-    int n = s.ctx.n();
     int m = int(s.e().size()) - 1;
+    if (s.tree.bisects()) {
+      locate_corner(s, i, 0, m, sink, extend);
+      return;
+    }
     for (int j = 0; j <= m; j++) {
       if (!s.is_valid())
         break;
-      auto cur = j < m ? s.split(s.ctx.is_left(s.e(j), s.e(j + 1), i)) : s;
-      if (!cur.is_valid())
-        continue;
-      // handle case when p(i, i - n) is under the trapezoids
-      if (0 < j && j < m) {
-        auto under = cur.split(s.ctx.is_over(i, i - n, s.e(j)));
-        if (under.is_valid()) {
-          if (extend)
-            add_corner_inside(under, i, j, sink);
-          else
-            sink.push_back(under);
-        }
-        if (!cur.is_valid())
-          continue;
-      }
-      // now handle case when it's over
-      add_corner_outside(cur, i, j, sink, extend);
+      // The last case takes over `s`
+      SofaState cur = j < m ?
+        s.split(s.ctx.is_left(s.e(j), s.e(j + 1), i)) : std::move(s);
+      add_corner_at(cur, i, j, sink, extend);
+    }
+  }
+}
+
+// The corner is right of v(lo - 1) and left of v(hi).
+// Halves the range with one split, so that a leaf gets O(log m)
+// constraints instead of O(m). The niche is x-monotone, so the corner is
+// in between v(j - 1) and v(j) for exactly one j.
+void locate_corner(
+    SofaState &s, int i, int lo, int hi, Sink &sink, bool extend) {
+  if (!s.is_valid())
+    return;
+  if (lo == hi) {
+    add_corner_at(s, i, lo, sink, extend);
+    return;
+  }
+  int mid = (lo + hi) / 2;
+  // `s` keeps the corner right of v(mid), the range [mid + 1, hi].
+  // The split-off state gets the corner left of v(mid), the range [lo, mid].
+  SofaState lower_half =
+    s.split(s.ctx.is_left(s.e(mid), s.e(mid + 1), i));
+  locate_corner(lower_half, i, lo, mid, sink, extend);
+  locate_corner(s, i, mid + 1, hi, sink, extend);
+}
+
+// The corner is in between v(j - 1) and v(j)
+void add_corner_at(SofaState &cur, int i, int j, Sink &sink, bool extend) {
+  if (!cur.is_valid())
+    return;
+  int n = cur.ctx.n();
+  int m = int(cur.e().size()) - 1;
+  // handle case when p(i, i - n) is under the trapezoids
+  if (0 < j && j < m) {
+    auto under = cur.split(cur.ctx.is_over(i, i - n, cur.e(j)));
+    if (under.is_valid()) {
+      if (extend)
+        add_corner_inside(under, i, j, sink);
+      else
+        sink.push_back(std::move(under));
     }
+    if (!cur.is_valid())
+      return;
   }
+  // now handle case when it's over
+  add_corner_outside(cur, i, j, sink, extend);
 }
 
 // Adding the corner p(i, i - n) inside the j'th trapezodial
@@ -106,7 +149,8 @@ void add_corner_outside(SofaState &s, int i, int j, Sink &sink, bool extend) {
     if (!s.is_valid())
       break;
     // left edge l decided: v(l-1) is over, v(l) ..., v(j-1) are under
-    auto sl = l > 0 ? s.split(s.ctx.is_under(s.e(l-1), s.e(l), i)) : s;
+    SofaState sl = l > 0 ?
+      s.split(s.ctx.is_under(s.e(l-1), s.e(l), i)) : std::move(s);
     if (!sl.is_valid())
       continue;
     // inner loop for deciding r
@@ -114,26 +158,20 @@ void add_corner_outside(SofaState &s, int i, int j, Sink &sink, bool extend) {
       if (!sl.is_valid())
         break;
       // right edge r decided
-      auto slr = r < m ? sl.split(s.ctx.is_under(s.e(r), s.e(r+1), i-n)) : sl;
+      SofaState slr = r < m ?
+        sl.split(sl.ctx.is_under(sl.e(r), sl.e(r+1), i-n)) : std::move(sl);
       // update niche edges
-      auto e = slr.e();
-      if (l == r) {
-        e.insert(e.begin() + l + 1, slr.e(l));
-        e.insert(e.begin() + l + 1, i - n);
-        e.insert(e.begin() + l + 1, i); // e, i, i-n, e
-      } else {
-        e.erase(e.begin() + l + 1, e.begin() + r);
-        e.insert(e.begin() + l + 1, i - n);
-        e.insert(e.begin() + l + 1, i);
-      }
-      slr.update_e(e);
+      if (l == r)
+        slr.update_e(l + 1, l + 1, {i, i - n, slr.e(l)}); // e, i, i-n, e
+      else
+        slr.update_e(l + 1, r, {i, i - n});
 
       if (!slr.is_valid())
         continue;
       if (extend)
         extend_line_left_right(slr, i, sink);
       else
-        sink.push_back(slr);
+        sink.push_back(std::move(slr));
     }
   }
 }
@@ -165,7 +203,7 @@ void extend_line_left_over(SofaState &s, int l, int pl, Sink &sink) {
   if (pl <= 0) {
     expect(pl == 0);
     if (s.is_valid())
-      sink.push_back(s);
+      sink.push_back(std::move(s));
   } else { // pl > 0
     expect(s.e(pl) != l);
     if (s.e(pl) < l) { // no possibility for going under
@@ -187,12 +225,9 @@ void extend_line_left_under(
     SofaState &s, int l, int pl, int cl, Sink &sink) {
   if (pl <= 0) {
     expect(pl == 0);
-    auto e = s.e();
-    e.erase(e.begin() + 1, e.begin() + cl);
-    e.insert(e.begin() + 1, l);
-    s.update_e(e);
+    s.update_e(1, cl, {l});
     if (s.is_valid())  
-      sink.push_back(s);
+      sink.push_back(std::move(s));
   } else { // cl > 0
     expect(s.e(pl) != l);
     if (s.e(pl) > l) { // still under
@@ -203,10 +238,7 @@ void extend_line_left_under(
         extend_line_left_under(s, l, pl - 1, cl, sink);
       if (s_over.is_valid()) {
         // pl ... cl
-        auto e = s_over.e();
-        e.erase(e.begin() + pl + 1, e.begin() + cl);
-        e.insert(e.begin() + pl + 1, l);
-        s_over.update_e(e);
+        s_over.update_e(pl + 1, cl, {l});
         if (s_over.is_valid())
           extend_line_left_over(s_over, l, pl - 1, sink);
       }
@@ -222,7 +254,7 @@ void extend_line_right_over(
   if (pl >= m) {
     expect(pl == m);
     if (s.is_valid())
-      sink.push_back(s);
+      sink.push_back(std::move(s));
   } else {
     expect(s.e(pl) != l);
     if (s.e(pl) > l) {
@@ -245,12 +277,9 @@ void extend_line_right_under(
   int m = int(s.e().size()) - 1;
   if (pl >= m) {
     expect(pl == m);
-    auto e = s.e();
-    e.erase(e.begin() + cl + 1, e.begin() + pl);
-    e.insert(e.begin() + cl + 1, l);
-    s.update_e(e);
+    s.update_e(cl + 1, pl, {l});
     if (s.is_valid()) {
-      sink.push_back(s);
+      sink.push_back(std::move(s));
     }
   } else { // pl < m
     expect(s.e(pl) != l);
@@ -262,10 +291,7 @@ void extend_line_right_under(
         extend_line_right_under(s, l, pl + 1, cl, sink);
       if (s_over.is_valid()) {
         // cl ... pl
-        auto e = s_over.e();
-        e.erase(e.begin() + cl + 1, e.begin() + pl);
-        e.insert(e.begin() + cl + 1, l);
-        s_over.update_e(e);
+        s_over.update_e(cl + 1, pl, {l});
         if (s_over.is_valid())
           extend_line_right_over(s_over, l, cl + 2, sink);
       }
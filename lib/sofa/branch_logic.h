@@ -14,5 +14,6 @@ typedef std::vector<SofaState> Sink;
 
 // function call = case division
 // push to sink = termination
+// `s` is moved into the sink when possible; only destroy it after
 void add_corner(
     SofaState &s, int i, Sink &sink, bool extend);
\ No newline at end of file
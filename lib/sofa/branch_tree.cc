@@ -1,24 +1,43 @@
 #include "branch_tree.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
 #include <iostream>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
 #include <thread>
-#include <future>
+#include <unordered_map>
+#include <functional>
 
 #include "tqdm.h"
 
+#include "json.h"
 #include "expect.h"
 #include "branch_logic.h"
 #include "cereal.h"
+#include "thread_pool.h"
 
 SofaBranchTree::SofaBranchTree(const SofaContext &ctx)
-    : ctx(ctx), last_state_id_(0) {
+    : ctx(ctx), num_roots_(1), frozen_(false), progress_(true),
+      bisect_(false),
+      last_state_id_(0),
+      num_splits_(0), num_invalid_(0), num_same_(0), memory_budget_(0), num_chunks_(0),
+      num_qps_(0) {
   valid_states_.push_back(SofaState(*this));
   // std::cout << valid_states_.back().is_valid() << std::endl;
   // std::cout << valid_states_.back().area() << std::endl;
 }
 
-SofaBranchTree::SofaBranchTree(const SofaContext &ctx, CerealReader &reader)
-    : ctx(ctx), last_state_id_(0) {
+SofaBranchTree::SofaBranchTree(
+    const SofaContext &ctx, CerealReader &reader, bool frozen, bool progress)
+    : ctx(ctx), num_roots_(0), frozen_(frozen), progress_(progress),
+      bisect_(false),
+      last_state_id_(0),
+      num_splits_(0), num_invalid_(0), num_same_(0), memory_budget_(0), num_chunks_(0),
+      num_qps_(0) {
   reader >> *this;
 }
 
@@ -26,7 +45,11 @@ SofaBranchTree::SofaBranchTree(
     const SofaContext &ctx,
     const Json::Value &split_nodes,
     const Json::Value &leaf_nodes)
-    : ctx(ctx), last_state_id_(0) {
+    : ctx(ctx), num_roots_(0), frozen_(true), progress_(true),
+      bisect_(false),
+      last_state_id_(0),
+      num_splits_(0), num_invalid_(0), num_same_(0), memory_budget_(0), num_chunks_(0),
+      num_qps_(0) {
   // don't update split_nodes
   // don't keep track of last ID
 
@@ -36,13 +59,19 @@ SofaBranchTree::SofaBranchTree(
   }
 }
 
+SofaBranchTree::~SofaBranchTree() {
+  std::error_code ec;
+  for (const auto &chunk : spill_chunks_)
+    std::filesystem::remove(chunk.first, ec);
+}
+
 const std::vector<SofaState> &SofaBranchTree::valid_states() const {
   return valid_states_;
 }
 
-std::vector<SofaState> process(
-    std::vector<SofaState> states, int i, bool extend, bool show_tqdm) {
-  std::vector<SofaState> results;
+// Consumes `states`
+void process(std::vector<SofaState> &states, std::vector<SofaState> &results,
+             int i, bool extend, bool show_tqdm) {
   if (show_tqdm) {
     tqdm bar;
     int c = 0;
@@ -58,37 +87,436 @@ std::vector<SofaState> process(
       ::add_corner(s, i, results, extend);
     }
   }
-  return results;
+  states.clear();
+}
+
+void SofaBranchTree::add_corner_(
+    std::vector<SofaState> &states, std::vector<SofaState> &results,
+    int i, bool extend, int nthread, std::vector<size_t> *runs) {
+  // Pinned workers get contiguous blocks: the states their rank made in the
+  // previous corner if `runs` records them, equal cuts otherwise
+  bool blocks = thread_pool().is_pinned();
+  bool keep_runs = blocks && runs && int(runs->size()) == nthread &&
+      std::accumulate(runs->begin(), runs->end(), size_t(0)) == states.size();
+  std::vector< std::vector<SofaState> > cur_states(nthread);
+  if (keep_runs) {
+    size_t idx = 0;
+    for (int rnk = 0; rnk < nthread; rnk++)
+      for (size_t k = 0; k < (*runs)[rnk]; k++)
+        cur_states[rnk].push_back(std::move(states[idx++]));
+  } else {
+    for (int idx = 0; idx < int(states.size()); idx++) {
+      int rnk = blocks ? int(size_t(idx) * nthread / states.size())
+                       : idx % nthread;
+      cur_states[rnk].push_back(std::move(states[idx]));
+    }
+  }
+  states.clear();
+  // for each state, propagate
+  std::vector< std::vector<SofaState> > nxt_states(nthread);
+  thread_pool().run(nthread, [&](int rnk) {
+    process(cur_states[rnk], nxt_states[rnk], i, extend, rnk == 0);
+  });
+  if (runs) {
+    runs->clear();
+    for (const auto &res : nxt_states)
+      runs->push_back(res.size());
+  }
+  if (nthread == 1 && results.empty()) {
+    results.swap(nxt_states[0]);
+  } else {
+    size_t total = results.size();
+    for (const auto &res : nxt_states)
+      total += res.size();
+    results.reserve(total);
+    for (auto &res : nxt_states)
+      for (auto &s : res)
+        results.push_back(std::move(s));
+  }
 }
 
 void SofaBranchTree::add_corner(int i, bool extend, int nthread) {
   int n = ctx.n();
   expect(1 <= i && i < n);
-  std::vector<SofaState> cur_states[nthread];
-  for (int idx = 0; idx < int(valid_states_.size()); idx++)
-    cur_states[idx % nthread].push_back(valid_states_[idx]);
-  valid_states_.clear();
-  // for each state, propagate
-  std::future< std::vector<SofaState> > nxt_states[nthread];
-  for (int rnk = 0; rnk < nthread; rnk++)
-    nxt_states[rnk] = std::async(process, cur_states[rnk], i, extend, rnk == 0);
-  for (int rnk = 0; rnk < nthread; rnk++) {
-    auto res = nxt_states[rnk].get();
-    for (const auto &vv : res)
-      valid_states_.push_back(vv);
+  std::vector<SofaState> states;
+  states.swap(valid_states_);
+
+  if (memory_budget_ == 0) {
+    add_corner_(states, valid_states_, i, extend, nthread, &rank_runs_);
+    if (qp_cache_) {
+      qp_cache_->clear();
+      dedupe_leaves_(valid_states_, &rank_runs_);
+    }
+  } else {
+    // Chunks mix the leaves of all ranks
+    rank_runs_.clear();
+    // The leaves in memory, then one chunk at a time
+    std::vector< std::pair<std::string, size_t> > chunks;
+    chunks.swap(spill_chunks_);
+    size_t bytes = 0;
+    for (size_t k = 0; ; k++) {
+      std::vector<SofaState> results;
+      add_corner_(states, results, i, extend, nthread);
+      // Kept across chunks, the QP results would outgrow the budget
+      if (qp_cache_)
+        qp_cache_->clear();
+      for (auto &s : results) {
+        bytes += s.memory_usage();
+        valid_states_.push_back(std::move(s));
+      }
+      if (bytes > memory_budget_ / 2) {
+        spill_(valid_states_);
+        bytes = 0;
+      }
+      if (k == chunks.size())
+        break;
+      unspill_(chunks[k].first, states);
+    }
+    if (qp_cache_) {
+      qp_cache_->clear();
+      dedupe_leaves_(valid_states_);
+    }
+  }
+  expect(num_splits_ + num_roots_ ==
+         num_states() + num_invalid_ + num_same_);
+}
+
+// Number of QP results kept with `dedupe` when the corners of a state
+// are added one after another, since states at different corners
+// hardly ever share a result
+static const size_t max_qp_cache = size_t(1) << 16;
+
+void SofaBranchTree::add_corners(
+    const std::vector< std::pair<int, bool> > &corners,
+    int nthread, size_t max_in_flight) {
+  gather();
+  int n = ctx.n();
+  for (const auto &corner : corners)
+    expect(1 <= corner.first && corner.first < n);
+  expect(nthread > 0 && max_in_flight > 0);
+  int num_stages = int(corners.size());
+  if (num_stages == 0)
+    return;
+
+  // States waiting for the k'th corner
+  std::vector< std::vector<SofaState> > queues(num_stages);
+  queues[0].swap(valid_states_);
+  rank_runs_.clear();
+  size_t num_roots = queues[0].size();
+  std::vector<SofaState> leaves;
+
+  std::mutex m;
+  std::condition_variable cv;
+  // States past the first corner, either queued or running
+  size_t in_flight = 0;
+  int running = 0;
+  std::exception_ptr error;
+  tqdm bar;
+
+  auto work = [&]() {
+    std::unique_lock<std::mutex> guard(m);
+    while (!error) {
+      int k = num_stages - 1;
+      while (k > 0 && queues[k].empty())
+        k--;
+      if (k == 0 && (queues[0].empty() || in_flight >= max_in_flight)) {
+        // Every queue is empty and no state can fill them again
+        if (queues[0].empty() && running == 0)
+          break;
+        cv.wait(guard);
+        continue;
+      }
+
+      SofaState s(std::move(queues[k].back()));
+      queues[k].pop_back();
+      if (k == 0) {
+        in_flight++;
+        bar.progress(int(num_roots - queues[0].size()), int(num_roots));
+      }
+      running++;
+      guard.unlock();
+      Sink children;
+      try {
+        ::add_corner(s, corners[k].first, children, corners[k].second);
+        if (qp_cache_ && qp_cache_->size() > max_qp_cache)
+          qp_cache_->clear();
+      } catch (...) {
+        guard.lock();
+        error = std::current_exception();
+        running--;
+        break;
+      }
+      guard.lock();
+      running--;
+      in_flight--;
+      if (k + 1 < num_stages) {
+        in_flight += children.size();
+        for (auto &c : children)
+          queues[k + 1].push_back(std::move(c));
+      } else {
+        for (auto &c : children)
+          leaves.push_back(std::move(c));
+      }
+      cv.notify_all();
+    }
+    cv.notify_all();
+  };
+
+  thread_pool().run(nthread, [&](int) { work(); });
+  if (error)
+    std::rethrow_exception(error);
+  bar.finish();
+
+  valid_states_.swap(leaves);
+  if (qp_cache_) {
+    qp_cache_->clear();
+    dedupe_leaves_(valid_states_);
+  }
+  expect(num_splits_ + num_roots_ ==
+         valid_states_.size() + num_invalid_ + num_same_);
+}
+
+QT SofaBranchTree::max_area_best_first(
+    const std::vector< std::pair<int, bool> > &corners) {
+  gather();
+  int n = ctx.n();
+  for (const auto &corner : corners)
+    expect(1 <= corner.first && corner.first < n);
+
+  // Open state with `depth` corners added so far
+  struct OpenState {
+    QT area;
+    size_t depth;
+    std::unique_ptr<SofaState> state;
+  };
+  auto by_area = [](const OpenState &a, const OpenState &b) {
+    return a.area < b.area;
+  };
+  std::vector<OpenState> open;
+
+  // Largest area of a state with every corner added
+  QT incumbent(0);
+  auto push = [&](SofaState &&s, size_t depth) {
+    auto state = std::make_unique<SofaState>(std::move(s));
+    // `area_` is only a lower bound after `update_e`, so certify it
+    QT area = state->area();
+    if (!state->is_valid())
+      return;
+    if (depth < corners.size() && area < incumbent) {
+      // Pruned: can't reach the top before the incumbent does
+      valid_states_.push_back(std::move(*state));
+      return;
+    }
+    if (depth == corners.size())
+      incumbent = std::max(incumbent, area);
+    open.push_back({area, depth, std::move(state)});
+    std::push_heap(open.begin(), open.end(), by_area);
+  };
+
+  std::vector<SofaState> roots;
+  roots.swap(valid_states_);
+  rank_runs_.clear();
+  for (auto &s : roots)
+    push(std::move(s), 0);
+
+  QT res(22195, 10000);
+  while (!open.empty()) {
+    std::pop_heap(open.begin(), open.end(), by_area);
+    OpenState top = std::move(open.back());
+    open.pop_back();
+    if (top.depth == corners.size()) {
+      // No open state can exceed this area
+      res = top.area;
+      valid_states_.push_back(std::move(*top.state));
+      break;
+    }
+    const auto &corner = corners[top.depth];
+    Sink children;
+    ::add_corner(*top.state, corner.first, children, corner.second);
+    for (auto &c : children)
+      push(std::move(c), top.depth + 1);
+    // There is no corner to clear it after, so bound it instead.
+    // Only the sharing of QPs is lost.
+    if (qp_cache_ && qp_cache_->size() > max_qp_cache)
+      qp_cache_->clear();
   }
-  expect(split_states_.size() + 1 == valid_states_.size() + invalid_states_.size());
+  if (qp_cache_)
+    qp_cache_->clear();
+
+  for (auto &o : open)
+    valid_states_.push_back(std::move(*o.state));
+  expect(num_splits_ + num_roots_ ==
+         valid_states_.size() + num_invalid_ + num_same_);
+  return res;
+}
+
+Json::Value DeadState::json() const {
+  Json::Value res(Json::objectValue);
+  res["id"] = id;
+  res["niche"] = to_json(e);
+  res["constraints"] = to_json(conds);
+  res["valid"] = false;
+  res["invalidity_proof"] = proof.json();
+  return res;
+}
+
+Json::Value MaxAreaLeaf::json() const {
+  Json::Value res(Json::objectValue);
+  res["id"] = id;
+  res["niche"] = to_json(e);
+  res["constraints"] = to_json(conds);
+  res["valid"] = true;
+  res["area"] = to_json(area);
+  if (proof)
+    res["optimality_proof"] = proof->json();
+  return res;
+}
+
+MaxAreaLeaf SofaBranchTree::max_area() {
+  gather();
+  // Areas of the leaves compared are certified by the thread
+  // comparing them, and are reused afterwards
+  int best = thread_pool().reduce(
+      valid_states_.size(), -1,
+      [](size_t k) { return int(k); },
+      [this](int a, int b) {
+        if (a < 0 || b < 0)
+          return std::max(a, b);
+        return valid_states_[b].area() > valid_states_[a].area() ? b : a;
+      });
+
+  if (best < 0)
+    return {QT(22195, 10000), -1, {}, {}, std::nullopt};
+  auto &s = valid_states_[best];
+  return {s.area(), s.id(), s.e(), s.conds(), s.area_proof()};
+}
+
+void SofaBranchTree::bisect(bool flag) {
+  bisect_ = flag;
+}
+
+bool SofaBranchTree::bisects() const {
+  return bisect_;
+}
+
+void SofaBranchTree::break_symmetry() {
+  expect(ctx.is_symmetric());
+  std::vector<SofaState> kept;
+  for (auto &s : valid_states_) {
+    s.impose(ctx.symmetry_probe());
+    if (s.is_valid())
+      kept.push_back(std::move(s));
+  }
+  valid_states_.swap(kept);
+  rank_runs_.clear();
+}
+
+void SofaBranchTree::dedupe(bool flag) {
+  if (!flag)
+    qp_cache_.reset();
+  else if (!qp_cache_)
+    qp_cache_ = std::make_unique<
+      SofaStateTable< std::shared_ptr<const SofaAreaResult> > >();
+}
+
+bool SofaBranchTree::dedupes() const {
+  return bool(qp_cache_);
+}
+
+void SofaBranchTree::dedupe_leaves_(
+    std::vector<SofaState> &states, std::vector<size_t> *runs) {
+  std::lock_guard<std::mutex> guard(lock_);
+  std::unordered_map<SofaStateKey, int, SofaStateKeyHash> seen;
+  std::vector<SofaState> kept;
+  // Run of the current state and the states left in it
+  size_t run = 0, left = 0;
+  for (auto &s : states) {
+    if (runs)
+      while (left == 0 && run < runs->size())
+        left = (*runs)[run++];
+    if (left > 0)
+      left--;
+    auto it = seen.emplace(s.key(), s.id()).first;
+    if (it->second == s.id()) {
+      kept.push_back(std::move(s));
+    } else {
+      record_same_(s, it->second);
+      if (runs && run > 0)
+        (*runs)[run - 1]--;
+    }
+  }
+  states.swap(kept);
+}
+
+void SofaBranchTree::memory_budget(size_t bytes, const std::string &dir) {
+  memory_budget_ = bytes;
+  spill_dir_ = dir;
+  if (bytes > 0)
+    std::filesystem::create_directories(dir);
+}
+
+void SofaBranchTree::spill_(std::vector<SofaState> &states) {
+  if (qp_cache_)
+    dedupe_leaves_(states);
+  // Sorted so that similar states are read back, and solved, together
+  std::vector<SofaStateKey> keys;
+  std::vector<size_t> order;
+  for (size_t k = 0; k < states.size(); k++) {
+    keys.push_back(states[k].key());
+    order.push_back(k);
+  }
+  std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) {
+    if (keys[a].e != keys[b].e)
+      return keys[a].e < keys[b].e;
+    return keys[a].conds < keys[b].conds;
+  });
+
+  std::string path = (std::filesystem::path(spill_dir_) /
+    ("spill" + std::to_string(num_chunks_++) + ".crl")).string();
+  CerealWriter writer(path.c_str());
+  writer << states.size();
+  for (auto k : order)
+    writer << states[k];
+  writer.close();
+  spill_chunks_.push_back({path, states.size()});
+  states.clear();
+}
+
+void SofaBranchTree::unspill_(
+    const std::string &path, std::vector<SofaState> &states) {
+  CerealReader reader(path.c_str());
+  size_t sz;
+  reader >> sz;
+  for (size_t k = 0; k < sz; k++)
+    states.push_back(SofaState(*this, reader, false));
+  reader.close();
+  std::filesystem::remove(path);
+}
+
+void SofaBranchTree::gather() {
+  for (const auto &chunk : spill_chunks_)
+    unspill_(chunk.first, valid_states_);
+  if (!spill_chunks_.empty())
+    rank_runs_.clear();
+  spill_chunks_.clear();
+}
+
+size_t SofaBranchTree::num_states() const {
+  size_t res = valid_states_.size();
+  for (const auto &chunk : spill_chunks_)
+    res += chunk.second;
+  return res;
 }
 
 Json::Value SofaBranchTree::split_nodes() const {
   Json::Value res;
 
-  for (auto const &split : split_states_) {
+  read_journal_([&](const SplitState &split) {
     auto &val = res["N" + std::to_string(split.id)];
     val["split_by"] = split.split_by;
     val["left"] = "N" + std::to_string(split.child_left_id);
     val["right"] = "N" + std::to_string(split.child_right_id);
-  }
+  }, [](const DeadState &) {}, [](const DeadState &, int) {});
 
   return res;
 }
@@ -101,14 +529,112 @@ Json::Value SofaBranchTree::leaf_nodes() const {
     val = leaf.json();
   }
 
-  for (auto const &leaf : invalid_states_) {
-    auto &val = res["N" + std::to_string(leaf.id_)];
-    val = leaf.json();
-  }
+  read_journal_([](const SplitState &) {}, [&](const DeadState &leaf) {
+    res["N" + std::to_string(leaf.id)] = leaf.json();
+  }, [&](const DeadState &leaf, int same_as) {
+    auto &val = res["N" + std::to_string(leaf.id)];
+    val["id"] = leaf.id;
+    val["niche"] = to_json(leaf.e);
+    val["constraints"] = to_json(leaf.conds);
+    val["valid"] = true;
+    val["same_as"] = "N" + std::to_string(same_as);
+  });
 
   return res;
 }
 
+void SofaBranchTree::record_to(const std::string &path) {
+  std::lock_guard<std::mutex> guard(lock_);
+  journal_ = std::make_unique<CerealWriter>(path.c_str());
+  if (!*journal_)
+    throw std::runtime_error("Cannot open journal " + path);
+  journal_path_ = path;
+}
+
+// Tags of the journal records
+enum JournalTag : int {
+  JOURNAL_SPLIT = 0, JOURNAL_DEAD = 1, JOURNAL_SAME = 2
+};
+
+void SofaBranchTree::record_split_(const SplitState &split) {
+  num_splits_++;
+  if (!journal_)
+    return;
+  *journal_ << int(JOURNAL_SPLIT) << split;
+}
+
+void SofaBranchTree::record_invalid_(const SofaState &s) {
+  num_invalid_++;
+  if (!journal_)
+    return;
+  *journal_ << int(JOURNAL_DEAD) << s.id_ << s.e_ << s.conds_.flat()
+            << *s.area_result_;
+}
+
+void SofaBranchTree::record_same_(const SofaState &s, int same_as) {
+  num_same_++;
+  if (!journal_)
+    return;
+  *journal_ << int(JOURNAL_SAME) << s.id_ << same_as << s.e_ << s.conds_.flat();
+}
+
+void SofaBranchTree::read_journal_(
+    const std::function<void(const SplitState &)> &on_split,
+    const std::function<void(const DeadState &)> &on_dead,
+    const std::function<void(const DeadState &, int)> &on_same) const {
+  if (!journal_)
+    return;
+  journal_->flush();
+  CerealReader in(journal_path_.c_str());
+  int tag;
+  while (in >> tag) {
+    if (tag == JOURNAL_SPLIT) {
+      SplitState split(0, 0, 0, 0);
+      in >> split;
+      on_split(split);
+    } else if (tag == JOURNAL_DEAD) {
+      DeadState dead;
+      in >> dead.id >> dead.e >> dead.conds >> dead.proof;
+      on_dead(dead);
+    } else {
+      expect(tag == JOURNAL_SAME);
+      DeadState same;
+      int same_as;
+      in >> same.id >> same_as >> same.e >> same.conds;
+      on_same(same, same_as);
+    }
+  }
+}
+
+void SofaBranchTree::clear() {
+  valid_states_.clear();
+  rank_runs_.clear();
+  for (const auto &chunk : spill_chunks_)
+    std::filesystem::remove(chunk.first);
+  spill_chunks_.clear();
+  num_splits_ = 0;
+  num_invalid_ = 0;
+  num_same_ = 0;
+  num_roots_ = 0;
+  if (journal_)
+    record_to(journal_path_);
+}
+
+void SofaBranchTree::merge(const SofaBranchTree &other) {
+  expect(&ctx == &other.ctx || ctx == other.ctx);
+  expect(other.spill_chunks_.empty());
+  rank_runs_.clear();
+  for (const auto &s : other.valid_states_) {
+    valid_states_.push_back(s);
+    valid_states_.back().id_ = new_state_id_();
+  }
+  num_roots_ += other.valid_states_.size();
+}
+
+long long SofaBranchTree::num_qps() const {
+  return num_qps_;
+}
+
 int SofaBranchTree::new_state_id_() {
   std::lock_guard<std::mutex> guard(lock_);
   last_state_id_++;
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "number.h"
@@ -9,6 +15,7 @@
 #include "context.h"
 #include "qp.h"
 #include "state.h"
+#include "state_key.h"
 
 struct SplitState {
   int id;
@@ -27,6 +34,31 @@ struct SplitState {
       child_right_id(child_right_id) {}
 };
 
+// What is left of an invalid or duplicate state in the journal
+struct DeadState {
+  int id;
+  std::vector<int> e;
+  SofaConstraints conds;
+  // Infeasible constraints, or a maximum area of at most 2.2195
+  SofaAreaResult proof;
+
+  // Same as `SofaState::json` of the state
+  Json::Value json() const;
+};
+
+// Leaf with the largest maximum area, and its certificate
+struct MaxAreaLeaf {
+  // 2.2195 and -1 if there is no leaf
+  QT area;
+  int id;
+  std::vector<int> e;
+  SofaConstraints conds;
+  std::optional<SofaAreaOptimalityProof> proof;
+
+  // Same as `SofaState::json` of the leaf, with its optimality proof
+  Json::Value json() const;
+};
+
 // TODO: the words 'state' and 'node' are used in mixed ways 
 
 class SofaBranchTree {
@@ -36,7 +68,10 @@ class SofaBranchTree {
     // Tree with initial search
     SofaBranchTree(const SofaContext &ctx);
     // Load from cereal stream
-    SofaBranchTree(const SofaContext &ctx, CerealReader &reader);
+    // Unless `frozen`, the loaded states can be branched further.
+    // Unless `progress`, nothing is printed while loading.
+    SofaBranchTree(const SofaContext &ctx, CerealReader &reader,
+                   bool frozen = true, bool progress = true);
     // Load from json
     explicit SofaBranchTree(
         const SofaContext &ctx,
@@ -47,13 +82,84 @@ class SofaBranchTree {
     SofaBranchTree() = delete;
     SofaBranchTree &operator=(const SofaBranchTree &other) = delete;
     SofaBranchTree &operator=(SofaBranchTree &&other) = delete;
+    ~SofaBranchTree();
 
-    // Current leaves of the branch-and-bound tree
+    // Current leaves of the branch-and-bound tree kept in memory
+    // Call `gather` first to include the spilled ones
     const std::vector<SofaState> &valid_states() const;
+    // Number of leaves, including the spilled ones
+    size_t num_states() const;
 
     // Runs a branch-and-bound algorithm by adding i'th corner
+    // The states are cut into `nthread` parts run on `thread_pool()`
     void add_corner(int i, bool extend = true, int nthread = 1);  
 
+    // Adds the corners (index, extend) in the given order without waiting
+    // for every state to finish a corner before the next one.
+    // A state enters the queue of the next corner as soon as it is done,
+    // and the deepest queued state is processed first.
+    // At most about `max_in_flight` states are past the first corner
+    // and not yet leaves at a time.
+    // With `dedupe`, a bounded number of recent QP results is kept
+    // and duplicate leaves are only removed after the last corner.
+    void add_corners(
+        const std::vector< std::pair<int, bool> > &corners,
+        int nthread = 1, size_t max_in_flight = 65536);
+
+    // Best-first branch-and-bound on the maximum area.
+    // Adds the corners (index, extend) in the given order, always expanding
+    // the open state with the largest area first, and stops as soon as
+    // a state with every corner added is on top.
+    // Returns the certified maximum area, or 2.2195 if no state survives.
+    // The open states are left in `valid_states()`.
+    QT max_area_best_first(const std::vector< std::pair<int, bool> > &corners);
+
+    // Largest maximum area over the leaves, computed on `thread_pool()`.
+    // Reuses the area of a leaf if it is certified since its last change.
+    MaxAreaLeaf max_area();
+
+    // If `bytes` is positive, `add_corner` writes the new leaves to
+    // sorted chunk files in `dir` whenever they take more than about half of
+    // `bytes`, and reads the chunks back one at a time for the next corner.
+    // With `dedupe`, QP results are shared and duplicates removed
+    // within a chunk only.
+    void memory_budget(size_t bytes, const std::string &dir);
+    // Reads every spilled leaf back into `valid_states()`
+    void gather();
+
+    // If set, corners are located on the niche by bisection
+    // instead of a chain of splits over the niche vertices
+    void bisect(bool flag);
+    bool bisects() const;
+
+    // Imposes `ctx.symmetry_probe()` on every leaf of a symmetric context,
+    // so that only one out of a sofa and its reflection is branched.
+    // Bounds of a form f over the whole tree are then the bounds of
+    // f and `ctx.mirror_form(f)` over the leaves.
+    void break_symmetry();
+
+    // Removes every leaf and record of splits, leaving an empty tree
+    // to `merge` other trees into
+    void clear();
+
+    // Adds the states of `other` to the current leaves.
+    // The added states get new IDs following the IDs of this tree.
+    void merge(const SofaBranchTree &other);
+
+    // Number of area QPs solved by states of this tree so far
+    long long num_qps() const;
+
+    // Appends every split and invalid state from now on
+    // to the journal at `path`, truncating it.
+    // Without a journal they are only counted.
+    void record_to(const std::string &path);
+
+    // If set, `add_corner` reuses the QP results of states with the same
+    // niche and constraints, and keeps one leaf out of those with
+    // the same niche and constraints. The others are journaled as the same.
+    void dedupe(bool flag);
+    bool dedupes() const;
+
     // TODO: Sets tqdm visibility
     void show_tqdm(bool flag);
 
@@ -61,6 +167,8 @@ class SofaBranchTree {
                                     const SofaBranchTree &v);
     friend CerealReader &operator>>(CerealReader &in, SofaBranchTree &v);
 
+    // Splits and leaves so far, read back from the journal
+    // Only the valid leaves are listed without a journal
     Json::Value split_nodes() const;
     Json::Value leaf_nodes() const;
 
@@ -68,16 +176,66 @@ class SofaBranchTree {
     // List of indices unioned so far with `add_corner`
     std::vector<int> indices_;
     std::vector<SofaState> valid_states_;
-
-    // Dead states
-    std::vector<SofaState> invalid_states_;
+    // Number of leaves the tree started from
+    size_t num_roots_;
+    // Whether states loaded from a stream are frozen
+    bool frozen_;
+    // Whether loading from a stream shows a progress bar
+    bool progress_;
+    // Whether corners are located by bisection
+    bool bisect_;
 
     // Splitting information
     std::mutex lock_;
     int last_state_id_;
     int new_state_id_();
 
-    std::vector<SplitState> split_states_;
+    // Leaves spilled to chunk files and the number of leaves in each
+    size_t memory_budget_;
+    std::string spill_dir_;
+    int num_chunks_;
+    std::vector< std::pair<std::string, size_t> > spill_chunks_;
+    // Writes `states` sorted to a new chunk, emptying it
+    void spill_(std::vector<SofaState> &states);
+    // Moves the leaves of chunk `path` to `states` and removes the file
+    void unspill_(const std::string &path, std::vector<SofaState> &states);
+    // Adds the i'th corner to `states`, appending the new leaves to `results`.
+    // If `runs` is given and covers `states` in `nthread` runs, rank k
+    // takes the k'th run; it is then set to the sizes of the ranks' results.
+    void add_corner_(std::vector<SofaState> &states,
+                     std::vector<SofaState> &results,
+                     int i, bool extend, int nthread,
+                     std::vector<size_t> *runs = nullptr);
+    // Sizes of the runs of `valid_states_` made by each rank of the last
+    // `add_corner`, in rank order, so that pinned workers keep their leaves.
+    // Empty once `valid_states_` is reordered.
+    std::vector<size_t> rank_runs_;
+
+    // Number of splits, dead states and duplicate leaves
+    size_t num_splits_;
+    size_t num_invalid_;
+    size_t num_same_;
+
+    // QP results of the current `add_corner`, if deduplicating
+    std::unique_ptr<
+      SofaStateTable< std::shared_ptr<const SofaAreaResult> > > qp_cache_;
+    // Removes duplicate leaves out of `states`, shrinking `runs` to match
+    void dedupe_leaves_(std::vector<SofaState> &states,
+                        std::vector<size_t> *runs = nullptr);
+
+    // Journal of splits and dead states, if any
+    std::string journal_path_;
+    std::unique_ptr<CerealWriter> journal_;
+    // Called with `lock_` held
+    void record_split_(const SplitState &split);
+    void record_invalid_(const SofaState &s);
+    void record_same_(const SofaState &s, int same_as);
+    void read_journal_(
+        const std::function<void(const SplitState &)> &on_split,
+        const std::function<void(const DeadState &)> &on_dead,
+        const std::function<void(const DeadState &, int)> &on_same) const;
+
+    std::atomic<long long> num_qps_;
 
     friend SofaState SofaState::split(SofaConstraintProbe cond);
     friend SofaState::SofaState(SofaBranchTree &tree, const Json::Value &json);
@@ -1,5 +1,6 @@
 #include "cereal.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <vector>
 
@@ -161,7 +162,7 @@ CerealWriter &operator<<(CerealWriter &out, const SofaState &v) {
   out << v.id_;
   out << v.is_valid_;
   out << v.e_;
-  out << v.conds_;
+  out << v.conds_.flat();
   out << v.area_;
   out << v.vars_;
   return out;
@@ -171,14 +172,35 @@ CerealReader &operator>>(CerealReader &in, SofaState &v) {
   in >> v.id_;
   in >> v.is_valid_;
   in >> v.e_;
-  in >> v.conds_;
+  SofaConstraints conds;
+  in >> conds;
+  v.conds_ = SofaConstraintList(conds);
   in >> v.area_;
   in >> v.vars_;
   return in;
 }
 
 CerealWriter &operator<<(CerealWriter &out, const SofaBranchTree &v) {
-  out << v.valid_states_;
+  out << v.num_states();
+  for (const auto &s : v.valid_states_)
+    out << s;
+  // Spilled leaves are copied field by field without making states
+  for (const auto &chunk : v.spill_chunks_) {
+    CerealReader in(chunk.first.c_str());
+    size_t sz;
+    in >> sz;
+    for (size_t i = 0; i < sz; i++) {
+      int id;
+      bool is_valid;
+      std::vector<int> e;
+      SofaConstraints conds;
+      QT area;
+      std::vector<QT> vars;
+      in >> id >> is_valid >> e >> conds >> area >> vars;
+      out << id << is_valid << e << conds << area << vars;
+    }
+    in.close();
+  }
   return out;
 }
 
@@ -188,9 +210,79 @@ CerealReader &operator>>(CerealReader &in, SofaBranchTree &v) {
   in >> sz;
   tqdm bar;
   for (size_t i = 0; i < sz; i++) {
-    bar.progress(i, sz);
-    v.valid_states_.push_back(SofaState(v, in));
+    if (v.progress_)
+      bar.progress(i, sz);
+    v.valid_states_.push_back(SofaState(v, in, v.frozen_));
+    v.last_state_id_ = std::max(v.last_state_id_, v.valid_states_.back().id());
+  }
+  // `finish` prints a newline even without a terminal
+  if (v.progress_)
+    bar.finish();
+  v.num_roots_ = v.valid_states_.size();
+  return in;
+}
+
+CerealWriter &operator<<(CerealWriter &out, const SplitState &v) {
+  out << v.id << v.split_by << v.child_left_id << v.child_right_id;
+  return out;
+}
+
+CerealReader &operator>>(CerealReader &in, SplitState &v) {
+  in >> v.id >> v.split_by >> v.child_left_id >> v.child_right_id;
+  return in;
+}
+
+CerealWriter &operator<<(CerealWriter &out, const SofaAreaInvalidityProof &v) {
+  out << v.lambdas << v.lambdas_extra;
+  return out;
+}
+
+CerealReader &operator>>(CerealReader &in, SofaAreaInvalidityProof &v) {
+  in >> v.lambdas >> v.lambdas_extra;
+  return in;
+}
+
+CerealWriter &operator<<(CerealWriter &out, const SofaAreaOptimalityProof &v) {
+  out << v.max_area << v.maximizer << bool(v.ldl);
+  if (v.ldl)
+    out << v.ldl->l << v.ldl->d;
+  out << v.lambdas << v.lambdas_extra;
+  return out;
+}
+
+CerealReader &operator>>(CerealReader &in, SofaAreaOptimalityProof &v) {
+  bool has_ldl;
+  in >> v.max_area >> v.maximizer >> has_ldl;
+  v.ldl.reset();
+  if (has_ldl) {
+    CholeskyLDL ldl;
+    in >> ldl.l >> ldl.d;
+    v.ldl = std::make_shared<const CholeskyLDL>(std::move(ldl));
+  }
+  in >> v.lambdas >> v.lambdas_extra;
+  return in;
+}
+
+CerealWriter &operator<<(CerealWriter &out, const SofaAreaResult &v) {
+  out << v.is_optimal();
+  if (v.is_optimal())
+    out << v.optimality_proof();
+  else
+    out << v.invalidity_proof();
+  return out;
+}
+
+CerealReader &operator>>(CerealReader &in, SofaAreaResult &v) {
+  bool optimal;
+  in >> optimal;
+  if (optimal) {
+    SofaAreaOptimalityProof proof;
+    in >> proof;
+    v.result = std::move(proof);
+  } else {
+    SofaAreaInvalidityProof proof;
+    in >> proof;
+    v.result = std::move(proof);
   }
-  bar.finish();
   return in;
 }
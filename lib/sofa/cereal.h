@@ -2,6 +2,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <map>
 
 #include "number.h"
 #include "forms.h"
@@ -25,10 +26,11 @@ class CerealReader : public std::ifstream {
 class CerealWriter : public std::ofstream {
   public:
     CerealWriter() = delete;
-    CerealWriter(const char *fname)
+    // Appends to the file if `append`, otherwise truncates it
+    CerealWriter(const char *fname, bool append = false)
         : std::ofstream(fname, std::ios::out | 
                                std::ios::binary | 
-                               std::ios::trunc) {
+                               (append ? std::ios::app : std::ios::trunc)) {
     }
 };
 
@@ -68,6 +70,14 @@ CerealWriter &operator<<(CerealWriter &out, const SofaState &v);
 CerealReader &operator>>(CerealReader &in, SofaState &v);
 CerealWriter &operator<<(CerealWriter &out, const SofaBranchTree &v);
 CerealReader &operator>>(CerealReader &in, SofaBranchTree &v);
+CerealWriter &operator<<(CerealWriter &out, const SplitState &v);
+CerealReader &operator>>(CerealReader &in, SplitState &v);
+CerealWriter &operator<<(CerealWriter &out, const SofaAreaInvalidityProof &v);
+CerealReader &operator>>(CerealReader &in, SofaAreaInvalidityProof &v);
+CerealWriter &operator<<(CerealWriter &out, const SofaAreaOptimalityProof &v);
+CerealReader &operator>>(CerealReader &in, SofaAreaOptimalityProof &v);
+CerealWriter &operator<<(CerealWriter &out, const SofaAreaResult &v);
+CerealReader &operator>>(CerealReader &in, SofaAreaResult &v);
 
 template <typename T>
 CerealWriter &operator<<(CerealWriter &out, const std::vector<T> &vec) {
@@ -89,3 +99,25 @@ CerealReader &operator>>(CerealReader &in, std::vector<T> &vec) {
   }
   return in;
 }
+
+template <typename K, typename V>
+CerealWriter &operator<<(CerealWriter &out, const std::map<K, V> &m) {
+  out << size_t(m.size());
+  for (const auto &[k, v] : m)
+    out << k << v;
+  return out;
+}
+
+template <typename K, typename V>
+CerealReader &operator>>(CerealReader &in, std::map<K, V> &m) {
+  m.clear();
+  size_t n;
+  in >> n;
+  for (size_t i = 0; i < n; i++) {
+    K k;
+    V v;
+    in >> k >> v;
+    m.emplace(k, v);
+  }
+  return in;
+}
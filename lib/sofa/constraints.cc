@@ -0,0 +1,47 @@
+#include "constraints.h"
+
+SofaConstraintList::SofaConstraintList() = default;
+
+SofaConstraintList::SofaConstraintList(const SofaConstraints &conds)
+    : tail_(conds) {
+  share();
+}
+
+size_t SofaConstraintList::size() const {
+  return (head_ ? head_->size : 0) + tail_.size();
+}
+
+void SofaConstraintList::push_back(SofaConstraintProbe cond) {
+  tail_.push_back(cond);
+}
+
+void SofaConstraintList::share() {
+  if (tail_.empty())
+    return;
+  size_t sz = size();
+  head_ = std::make_shared<const Chunk>(Chunk{head_, sz, std::move(tail_)});
+  tail_.clear();
+}
+
+SofaConstraints SofaConstraintList::flat() const {
+  std::vector<const Chunk *> chunks;
+  for (const Chunk *c = head_.get(); c; c = c->parent.get())
+    chunks.push_back(c);
+
+  SofaConstraints res;
+  res.reserve(size());
+  for (auto it = chunks.rbegin(); it != chunks.rend(); ++it)
+    res.insert(res.end(), (*it)->conds.begin(), (*it)->conds.end());
+  res.insert(res.end(), tail_.begin(), tail_.end());
+  return res;
+}
+
+bool SofaConstraintList::operator==(const SofaConstraintList &other) const {
+  if (head_ == other.head_)
+    return tail_ == other.tail_;
+  return size() == other.size() && flat() == other.flat();
+}
+
+bool SofaConstraintList::operator!=(const SofaConstraintList &other) const {
+  return !(*this == other);
+}
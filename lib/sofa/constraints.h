@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "context.h"
+
+// Persistent list of constraints.
+// Copies share every constraint that was `share`d before the copy,
+// so the constraints common to a state and its descendants are stored once.
+// The list is a chain of immutable chunks linked to their parents,
+// followed by a tail of constraints owned by this list only.
+class SofaConstraintList {
+  public:
+    SofaConstraintList();
+    SofaConstraintList(const SofaConstraints &conds);
+
+    size_t size() const;
+    void push_back(SofaConstraintProbe cond);
+
+    // Moves the tail to a new chunk, so that copies made afterwards
+    // share it instead of copying it
+    void share();
+
+    // Flat view of the constraints, in the order they were added
+    SofaConstraints flat() const;
+
+    bool operator==(const SofaConstraintList &other) const;
+    bool operator!=(const SofaConstraintList &other) const;
+
+  private:
+    struct Chunk {
+      std::shared_ptr<const Chunk> parent;
+      // Number of constraints up to and including this chunk
+      size_t size;
+      SofaConstraints conds;
+    };
+
+    std::shared_ptr<const Chunk> head_;
+    SofaConstraints tail_;
+};
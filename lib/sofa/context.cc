@@ -4,6 +4,7 @@
 
 #include "expect.h"
 #include "cereal.h"
+#include "qp.h"
 
 SofaContext::SofaContext(const std::vector<Vector> &u) {
   initialize(u);
@@ -162,6 +163,36 @@ void SofaContext::initialize(const std::vector<Vector> &u_in) {
           std::to_string(j) + " " + std::to_string(k));
       }
 
+  // Reflection along the y-axis maps u(i) to u(2n - i) if symmetric
+  is_symmetric_ = n_ >= 2;
+  for (int i = 0; i <= n_; i++)
+    if (!(u_[i] == Vector(u_[n_ - i].y, u_[n_ - i].x)))
+      is_symmetric_ = false;
+  if (is_symmetric_) {
+    // Support value i of the reflected sofa, translated back to s_0 = 0:
+    // s_{2n - i} - u(i).x * s_{2n}
+    auto var = [this](int i) { return i < n_ ? i - 1 : i - 2; };
+    sigma_.resize(d_);
+    for (int i = 1; i <= 2 * n_; i++) {
+      if (i == n_)
+        continue;
+      auto &terms = sigma_[var(i)];
+      if (2 * n_ - i != 0)
+        terms.emplace_back(var(2 * n_ - i), QT(1));
+      if (u(i).x != 0) {
+        if (!terms.empty() && terms.back().first == var(2 * n_))
+          terms.back().second -= u(i).x;
+        else
+          terms.emplace_back(var(2 * n_), -u(i).x);
+      }
+    }
+
+    // Any s with s - mirror(s) nonzero and antisymmetric does
+    symmetry_probe_ = int(ineqs_.size());
+    LinearForm s1 = LinearForm::variable(d_, 0);
+    add_ineq_(s1 - mirror_form(s1) >= QT(0), "m");
+  }
+
   extra_ineqs_offset_ = int(ineqs_.size());
 
   auto rev_ineqs = ineqs_;
@@ -169,6 +200,67 @@ void SofaContext::initialize(const std::vector<Vector> &u_in) {
     v = v.negate();
   ineqs_.insert(ineqs_.begin(), rev_ineqs.rbegin(), rev_ineqs.rend() - 1);
   ineqs_zero_ = ineqs_.begin() + rev_ineqs.size() - 1;
+
+  if (is_symmetric_)
+    initialize_mirror_();
+}
+
+// Whether f == c * g for some c > 0, or both are zero
+static bool is_positive_multiple(const LinearForm &f, const LinearForm &g) {
+  std::vector<QT> fw = f.w1(), gw = g.w1();
+  fw.push_back(f.w0());
+  gw.push_back(g.w0());
+  QT c(0);
+  for (size_t k = 0; k < fw.size(); k++) {
+    if (gw[k] == 0) {
+      if (fw[k] != 0)
+        return false;
+    } else if (c == 0) {
+      c = fw[k] / gw[k];
+      if (c <= 0)
+        return false;
+    } else if (fw[k] != c * gw[k]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void SofaContext::initialize_mirror_() {
+  mirror_.assign(extra_ineqs_offset_, 0);
+
+  // Convexity of side i is convexity of side 2n - i of the reflection,
+  // matched by their inequalities
+  for (int p = default_ineqs_offset_; p < left_ineqs_offset_; p++) {
+    auto g = ineq(p).nonneg_value();
+    for (int q = default_ineqs_offset_; q < left_ineqs_offset_; q++)
+      if (is_positive_multiple(g, mirror_form(ineq(q).nonneg_value())))
+        mirror_[p] = q;
+  }
+  // Left and right swap, as x(l) and x(n - l) do
+  for (int l = 1; l <= (n_ - 1); l++)
+    for (int j = -(n_ - 1); j <= (n_ - 1); j++)
+      for (int i = -(n_ - 1); i < j; i++)
+        mirror_[is_left(i, j, l)] = -is_left(-j, -i, n_ - l);
+  // Over stays over
+  for (int k = -(n_ - 1); k <= (n_ - 1); k++)
+    for (int j = -(n_ - 1); j < k; j++)
+      for (int i = -(n_ - 1); i < j; i++)
+        mirror_[is_over(i, j, k)] = is_over(-i, -j, -k);
+  mirror_[symmetry_probe_] = -symmetry_probe_;
+
+  for (int p = default_ineqs_offset_; p < extra_ineqs_offset_; p++)
+    expect(is_positive_multiple(
+        ineq(p).nonneg_value(),
+        mirror_form(ineq(mirror_[p]).nonneg_value())));
+}
+
+bool SofaContext::operator==(const SofaContext &other) const {
+  return u_ == other.u_;
+}
+
+bool SofaContext::operator!=(const SofaContext &other) const {
+  return !(*this == other);
 }
 
 int SofaContext::n() const {
@@ -323,6 +415,78 @@ QuadraticForm SofaContext::area(const std::vector<int> &pl) const {
   return area;
 }
 
+// Number of shapes whose proofs are kept
+static const size_t max_nsd = 4096;
+
+std::shared_ptr<const CholeskyLDL> SofaContext::area_nsd(
+    const std::vector<int> &pl) const {
+  {
+    std::lock_guard<std::mutex> guard(nsd_lock_);
+    auto it = nsd_.find(pl);
+    if (it != nsd_.end()) {
+      nsd_order_.splice(nsd_order_.begin(), nsd_order_, it->second.second);
+      return it->second.first;
+    }
+  }
+  // Computed outside the lock; a race only computes it twice
+  auto proof = is_negative_semidefinite(area(pl).w2());
+  expect(proof);
+  auto res = std::make_shared<const CholeskyLDL>(std::move(proof.value()));
+  std::lock_guard<std::mutex> guard(nsd_lock_);
+  auto it = nsd_.find(pl);
+  if (it != nsd_.end())
+    return it->second.first;
+  nsd_order_.push_front(pl);
+  nsd_.emplace(pl, std::make_pair(res, nsd_order_.begin()));
+  if (nsd_.size() > max_nsd) {
+    nsd_.erase(nsd_order_.back());
+    nsd_order_.pop_back();
+  }
+  return res;
+}
+
+bool SofaContext::is_symmetric() const {
+  return is_symmetric_;
+}
+
+std::vector<QT> SofaContext::mirror_vars(const std::vector<QT> &vars) const {
+  expect(is_symmetric_ && int(vars.size()) == d_);
+  std::vector<QT> res(d_);
+  for (int k = 0; k < d_; k++)
+    for (const auto &[j, w] : sigma_[k])
+      res[k] += w * vars[j];
+  return res;
+}
+
+LinearForm SofaContext::mirror_form(const LinearForm &f) const {
+  expect(is_symmetric_ && f.d() == d_);
+  LinearForm res = LinearForm::constant(d_, f.w0());
+  for (int k = 0; k < d_; k++)
+    if (f.w1(k) != 0)
+      for (const auto &[j, w] : sigma_[k])
+        res.w1(j) += f.w1(k) * w;
+  return res;
+}
+
+std::vector<int> SofaContext::mirror_niche(const std::vector<int> &pl) const {
+  expect(is_symmetric_);
+  std::vector<int> res(pl.rbegin(), pl.rend());
+  for (auto &e : res)
+    e = -e;
+  return res;
+}
+
+SofaConstraintProbe SofaContext::mirror_probe(SofaConstraintProbe p) const {
+  expect(is_symmetric_);
+  expect(p != 0 && -extra_ineqs_offset_ < p && p < extra_ineqs_offset_);
+  return p > 0 ? mirror_[p] : -mirror_[-p];
+}
+
+SofaConstraintProbe SofaContext::symmetry_probe() const {
+  expect(is_symmetric_);
+  return symmetry_probe_;
+}
+
 Json::Value SofaContext::split_values() const {
   Json::Value values(Json::arrayValue);
   values.append(Json::Value::null);
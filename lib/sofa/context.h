@@ -1,6 +1,10 @@
 #pragma once
 
 #include <algorithm>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -16,6 +20,7 @@ using SofaConstraints = std::vector<SofaConstraintProbe>;
 
 class CerealReader;
 class CerealWriter;
+struct CholeskyLDL;
 
 class SofaContext {
   public:
@@ -32,6 +37,10 @@ class SofaContext {
     // Does the same thing as constructor, replacing the original context
     void initialize(const std::vector<Vector> &u);
 
+    // Contexts are equal if they come from the same angles
+    bool operator==(const SofaContext &other) const;
+    bool operator!=(const SofaContext &other) const;
+
     // Size of partition
     int n() const;
     // The number of variables d = 2n-1 involved
@@ -125,6 +134,28 @@ class SofaContext {
 
     // Area function for a specified shape
     QuadraticForm area(const std::vector<int> &polyline) const;
+    // Proof that the area function is negative semidefinite,
+    // shared while the shape is among the recently used ones
+    std::shared_ptr<const CholeskyLDL> area_nsd(
+        const std::vector<int> &polyline) const;
+
+    // Reflection symmetry
+    // If the angles are symmetric under swapping cos and sin,
+    // the reflection of a sofa along the y-axis is again a sofa
+    // with the same area, and line i of one is line -i of the other.
+    bool is_symmetric() const;
+    // The following are only defined for a symmetric context.
+    // Variables of the reflected sofa
+    std::vector<QT> mirror_vars(const std::vector<QT> &vars) const;
+    // Form g with g(vars) == f(mirror_vars(vars))
+    LinearForm mirror_form(const LinearForm &f) const;
+    // Niche of the reflected sofa
+    std::vector<int> mirror_niche(const std::vector<int> &polyline) const;
+    // Probe that holds for the reflected sofa iff `p` holds for the sofa
+    SofaConstraintProbe mirror_probe(SofaConstraintProbe p) const;
+    // Probe p with mirror_probe(p) == -p. Out of a sofa and its reflection,
+    // one always satisfies p, so imposing p loses no sofa up to reflection.
+    SofaConstraintProbe symmetry_probe() const;
 
     friend CerealWriter &operator<<(CerealWriter &out, const SofaContext &v);
     friend CerealReader &operator>>(CerealReader &in, SofaContext &v);
@@ -155,7 +186,25 @@ class SofaContext {
     SofaConstraintProbe over_ineqs_offset_;
     SofaConstraintProbe extra_ineqs_offset_;
 
+    bool is_symmetric_;
+    // `sigma_[k]`: k'th variable of the reflected sofa as (index, weight)
+    // terms in the variables of the sofa
+    std::vector< std::vector< std::pair<int, QT> > > sigma_;
+    // Mirrors of the probes 0 <= p < extra_ineqs_offset_
+    std::vector<SofaConstraintProbe> mirror_;
+    SofaConstraintProbe symmetry_probe_;
+
+    // Proofs of the most recently used shapes, which come first
+    // in `nsd_order_`
+    mutable std::mutex nsd_lock_;
+    mutable std::list< std::vector<int> > nsd_order_;
+    mutable std::map< std::vector<int>,
+      std::pair< std::shared_ptr<const CholeskyLDL>,
+                 std::list< std::vector<int> >::iterator > > nsd_;
+
     void add_ineq_(const LinearInequality &ineq, const std::string &name);
+    // Fills `mirror_` and checks it against the inequalities
+    void initialize_mirror_();
 
     int index_(int i, int j) const;
     int index_(int i, int j, int k) const;
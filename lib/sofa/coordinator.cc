@@ -0,0 +1,267 @@
+#include "coordinator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tqdm.h"
+
+#include "expect.h"
+#include "cereal.h"
+
+// Number of times a task may kill its worker before giving up
+static const int max_task_failures = 3;
+
+struct Worker {
+  pid_t pid;
+  // The coordinator writes task IDs to `task_fd`,
+  // and the worker writes back the IDs of finished tasks to `result_fd`
+  int task_fd;
+  int result_fd;
+  // Task in progress, or -1 if idle
+  int task;
+};
+
+static std::string task_path(const std::string &dir, int id) {
+  return dir + "/task" + std::to_string(id) + ".crl";
+}
+
+static std::string result_path(const std::string &dir, int id) {
+  return dir + "/result" + std::to_string(id) + ".crl";
+}
+
+static bool read_id(int fd, int &id) {
+  char *buf = (char *)&id;
+  size_t done = 0;
+  while (done < sizeof(id)) {
+    ssize_t r = read(fd, buf + done, sizeof(id) - done);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    done += r;
+  }
+  return true;
+}
+
+static bool write_id(int fd, int id) {
+  const char *buf = (const char *)&id;
+  size_t done = 0;
+  while (done < sizeof(id)) {
+    ssize_t r = write(fd, buf + done, sizeof(id) - done);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return false;
+    done += r;
+  }
+  return true;
+}
+
+[[noreturn]] static void run_worker(
+    const SofaContext &ctx,
+    const std::vector< std::pair<int, bool> > &corners,
+    const std::string &work_dir,
+    bool dedupe, bool bisect,
+    int task_fd, int result_fd) {
+  try {
+    int id;
+    while (read_id(task_fd, id)) {
+      CerealReader reader(task_path(work_dir, id).c_str());
+      SofaBranchTree t(ctx, reader, false);
+      reader.close();
+      t.dedupe(dedupe);
+      t.bisect(bisect);
+      for (const auto &corner : corners)
+        t.add_corner(corner.first, corner.second);
+
+      // Rename so that the coordinator never sees a partial result
+      std::string path = result_path(work_dir, id);
+      std::string tmp_path = path + ".tmp";
+      CerealWriter writer(tmp_path.c_str());
+      writer << t;
+      writer.close();
+      std::filesystem::rename(tmp_path, path);
+      if (!write_id(result_fd, id))
+        break;
+    }
+  } catch (std::exception &e) {
+    std::cerr << "worker error: " << e.what() << std::endl;
+    _exit(1);
+  }
+  _exit(0);
+}
+
+static Worker spawn_worker(
+    const SofaContext &ctx,
+    const std::vector< std::pair<int, bool> > &corners,
+    const std::string &work_dir,
+    bool dedupe, bool bisect,
+    const std::vector<Worker> &others) {
+  int to_worker[2], from_worker[2];
+  if (pipe(to_worker) != 0)
+    throw std::runtime_error("Cannot create pipe");
+  if (pipe(from_worker) != 0)
+    throw std::runtime_error("Cannot create pipe");
+
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid < 0)
+    throw std::runtime_error("Cannot fork worker");
+
+  if (pid == 0) {
+    // Let the other workers see EOF once the coordinator closes their pipes
+    for (const auto &w : others) {
+      close(w.task_fd);
+      close(w.result_fd);
+    }
+    close(to_worker[1]);
+    close(from_worker[0]);
+    // Workers are quiet, progress is shown by the coordinator
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0)
+      dup2(devnull, STDOUT_FILENO);
+    run_worker(ctx, corners, work_dir, dedupe, bisect,
+               to_worker[0], from_worker[1]);
+  }
+
+  close(to_worker[0]);
+  close(from_worker[1]);
+  return {pid, to_worker[1], from_worker[0], -1};
+}
+
+void add_corners_with_workers(
+    SofaBranchTree &tree,
+    const std::vector< std::pair<int, bool> > &corners,
+    int nworkers,
+    size_t task_size,
+    const std::string &work_dir) {
+  expect(nworkers > 0);
+  expect(task_size > 0);
+  std::filesystem::create_directories(work_dir);
+
+  // Cut the leaves into tasks
+  const auto &states = tree.valid_states();
+  int num_tasks = 0;
+  for (size_t i = 0; i < states.size(); i += task_size) {
+    size_t j = std::min(states.size(), i + task_size);
+    std::vector<SofaState> task(states.begin() + i, states.begin() + j);
+    CerealWriter writer(task_path(work_dir, num_tasks++).c_str());
+    writer << task;
+    writer.close();
+  }
+  tree.clear();
+
+  // A dead worker is noticed through its pipes, not through SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<Worker> workers;
+  for (int i = 0; i < nworkers; i++)
+    workers.push_back(spawn_worker(
+        tree.ctx, corners, work_dir,
+        tree.dedupes(), tree.bisects(), workers));
+
+  std::deque<int> pending;
+  for (int id = 0; id < num_tasks; id++)
+    pending.push_back(id);
+  std::vector<int> failures(num_tasks, 0);
+  int finished = 0;
+
+  tqdm bar;
+  try {
+    while (finished < num_tasks) {
+      bar.progress(finished, num_tasks);
+      for (auto &w : workers) {
+        if (w.task >= 0 || pending.empty())
+          continue;
+        // On failure the worker is dead, and poll() reports it below
+        if (write_id(w.task_fd, pending.front())) {
+          w.task = pending.front();
+          pending.pop_front();
+        }
+      }
+
+      std::vector<pollfd> fds;
+      for (const auto &w : workers)
+        fds.push_back({w.result_fd, POLLIN, 0});
+      if (poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno == EINTR)
+          continue;
+        throw std::runtime_error("poll failed");
+      }
+
+      for (size_t i = 0; i < workers.size(); i++) {
+        if (!fds[i].revents)
+          continue;
+        auto &w = workers[i];
+        int id;
+        if ((fds[i].revents & POLLIN) && read_id(w.result_fd, id)) {
+          // Task finished
+          expect(id == w.task);
+          std::string path = result_path(work_dir, id);
+          CerealReader reader(path.c_str());
+          SofaBranchTree result(tree.ctx, reader, false);
+          reader.close();
+          tree.merge(result);
+          std::filesystem::remove(path);
+          std::filesystem::remove(task_path(work_dir, id));
+          w.task = -1;
+          finished++;
+        } else {
+          // Worker died: replace it and queue its task again
+          int status;
+          close(w.task_fd);
+          close(w.result_fd);
+          pid_t dead = w.pid;
+          waitpid(dead, &status, 0);
+          w.pid = -1;
+          if (w.task >= 0) {
+            std::cerr << "Worker " << dead << " died on task " << w.task
+                      << std::endl;
+            if (++failures[w.task] >= max_task_failures)
+              throw std::runtime_error(
+                  "Task " + std::to_string(w.task) + " keeps failing");
+            pending.push_front(w.task);
+          }
+          std::vector<Worker> others(workers);
+          others.erase(others.begin() + i);
+          w = spawn_worker(
+              tree.ctx, corners, work_dir,
+              tree.dedupes(), tree.bisects(), others);
+        }
+      }
+    }
+  } catch (...) {
+    // Stop the workers before giving up
+    for (auto &w : workers) {
+      if (w.pid < 0)
+        continue;
+      kill(w.pid, SIGKILL);
+      close(w.task_fd);
+      close(w.result_fd);
+      int status;
+      waitpid(w.pid, &status, 0);
+    }
+    throw;
+  }
+  bar.finish();
+
+  // Workers exit on EOF
+  for (auto &w : workers)
+    close(w.task_fd);
+  for (auto &w : workers) {
+    int status;
+    waitpid(w.pid, &status, 0);
+    close(w.result_fd);
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "branch_tree.h"
+
+// Adds `corners` (index, extend) to the leaves of `tree` with `nworkers`
+// forked worker processes.
+// The leaves are cut into tasks of at most `task_size` states, handed out
+// to idle workers as files in `work_dir` in cereal format, and the leaves
+// each worker finds are streamed back the same way.
+// A worker that dies is replaced and its task is queued again.
+// Afterwards the leaves of `tree` are the leaves found by the workers,
+// with fresh IDs.
+void add_corners_with_workers(
+    SofaBranchTree &tree,
+    const std::vector< std::pair<int, bool> > &corners,
+    int nworkers,
+    size_t task_size,
+    const std::string &work_dir);
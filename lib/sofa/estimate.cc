@@ -0,0 +1,92 @@
+#include "estimate.h"
+
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "tqdm.h"
+
+#include "expect.h"
+#include "branch_logic.h"
+
+// Running sums of a sampled quantity
+struct Moments {
+  double sum = 0, sum_sq = 0;
+
+  void add(double x) {
+    sum += x;
+    sum_sq += x * x;
+  }
+
+  Estimate estimate(int n) const {
+    double mean = sum / n;
+    double var = n > 1 ? (sum_sq - n * mean * mean) / (n - 1) : 0;
+    return {mean, 1.96 * std::sqrt(std::max(var, 0.0) / n)};
+  }
+};
+
+std::vector<CornerEstimate> estimate_tree(
+    SofaBranchTree &tree,
+    const std::vector< std::pair<int, bool> > &corners,
+    int samples,
+    unsigned int seed) {
+  expect(samples > 0);
+  int k = int(corners.size());
+  std::vector<Moments> states(k), qps(k), seconds(k);
+  std::mt19937 rng(seed);
+
+  const auto &roots = tree.valid_states();
+  tqdm bar;
+  for (int t = 0; t < samples; t++) {
+    bar.progress(t, samples);
+    if (roots.empty())
+      break;
+
+    std::uniform_int_distribution<size_t> pick_root(0, roots.size() - 1);
+    Sink cur;
+    cur.push_back(roots[pick_root(rng)]);
+    // Number of states the current state stands for
+    double weight = double(roots.size());
+
+    for (int c = 0; c < k; c++) {
+      if (cur.empty()) {
+        // Path died: every later layer is empty along it
+        for (int cc = c; cc < k; cc++) {
+          states[cc].add(0);
+          qps[cc].add(0);
+          seconds[cc].add(0);
+        }
+        break;
+      }
+
+      Sink children;
+      long long qps_start = tree.num_qps();
+      auto start = std::chrono::steady_clock::now();
+      add_corner(cur.back(), corners[c].first, children, corners[c].second);
+      std::chrono::duration<double> dt =
+        std::chrono::steady_clock::now() - start;
+
+      qps[c].add(weight * (tree.num_qps() - qps_start));
+      seconds[c].add(weight * dt.count());
+      weight *= children.size();
+      states[c].add(weight);
+
+      cur.clear();
+      if (!children.empty()) {
+        std::uniform_int_distribution<size_t> pick(0, children.size() - 1);
+        cur.push_back(children[pick(rng)]);
+      }
+    }
+  }
+  bar.finish();
+
+  std::vector<CornerEstimate> res;
+  for (int c = 0; c < k; c++)
+    res.push_back({
+        corners[c].first,
+        states[c].estimate(samples),
+        qps[c].estimate(samples),
+        seconds[c].estimate(samples)});
+  return res;
+}
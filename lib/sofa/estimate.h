@@ -0,0 +1,33 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "branch_tree.h"
+
+// Estimated quantity with the half-width of its 95% confidence interval
+struct Estimate {
+  double mean;
+  double err;
+};
+
+struct CornerEstimate {
+  int corner;
+  // Number of states after adding the corner
+  Estimate states;
+  // Number of QPs and running time in seconds spent adding the corner
+  Estimate qps;
+  Estimate seconds;
+};
+
+// Knuth-style estimate of the tree grown from the states of `tree`
+// by adding `corners` (index, extend) in order.
+// Each sample follows a single path from a random state of `tree`:
+// it adds the next corner to the current state only, moves to one of
+// the resulting states uniformly at random, and weights the path by
+// the number of choices made so far.
+std::vector<CornerEstimate> estimate_tree(
+    SofaBranchTree &tree,
+    const std::vector< std::pair<int, bool> > &corners,
+    int samples,
+    unsigned int seed = 0);
@@ -0,0 +1,112 @@
+#include "layers.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include "context.h"
+#include "cereal.h"
+
+std::string layers_path(const std::string &path) {
+  return path + ".layers";
+}
+
+std::string layer_path(const std::string &path, size_t k) {
+  return (std::filesystem::path(layers_path(path)) /
+    ("layer" + std::to_string(k) + ".crl")).string();
+}
+
+std::vector< std::pair<int, bool> > branch_corners(
+    const Json::Value &angles) {
+  std::vector< std::pair<int, int> > order_pair;
+
+  for (int i = 0; i < int(angles.size()); i++) {
+    const auto &angle = angles[i];
+    int order = angle["branch_order"].asInt();
+    if (order < 0)
+      continue;
+    order_pair.emplace_back(order, i + 1);
+  }
+
+  // Determine the corner indices in branching order
+  std::sort(order_pair.begin(), order_pair.end());
+  std::vector<int> bidx(order_pair.size());
+  for (size_t i = 0; i < order_pair.size(); i++)
+    bidx[i] = order_pair[i].second;
+
+  std::vector< std::pair<int, bool> > corners;
+  for (auto i : bidx)
+    corners.emplace_back(i, angles[i - 1]["extend"].asBool());
+  return corners;
+}
+
+size_t reusable_prefix(
+    const std::string &prev,
+    const Json::Value &angles,
+    const Json::Value &options) {
+  std::filesystem::path dir(layers_path(prev));
+  std::ifstream angles_f(dir / "angles.json");
+  std::ifstream options_f(dir / "options.json");
+  if (!angles_f || !options_f)
+    return 0;
+  Json::Value prev_angles, prev_options;
+  angles_f >> prev_angles;
+  options_f >> prev_options;
+  if (prev_options != options ||
+      SofaContext(prev_angles) != SofaContext(angles))
+    return 0;
+
+  auto corners = branch_corners(angles);
+  auto prev_corners = branch_corners(prev_angles);
+  size_t common = 0;
+  while (common < std::min(corners.size(), prev_corners.size()) &&
+         corners[common] == prev_corners[common])
+    common++;
+  // Only the layers are read, as the tree `prev` itself may have been
+  // written since by a run without layers
+  for (size_t k = common; k > 0; k--)
+    if (std::filesystem::exists(layer_path(prev, k)))
+      return k;
+  return 0;
+}
+
+void start_layers(
+    const std::string &out, const std::string &prev,
+    const Json::Value &angles, const Json::Value &options,
+    size_t reused) {
+  std::filesystem::path dir(layers_path(out));
+  std::filesystem::create_directories(dir);
+  if (reused > 0 && layers_path(prev) != dir.string()) {
+    for (size_t k = 1; k <= reused; k++) {
+      auto from = layer_path(prev, k);
+      if (std::filesystem::exists(from))
+        std::filesystem::copy_file(
+            from, layer_path(out, k),
+            std::filesystem::copy_options::overwrite_existing);
+    }
+  }
+  for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+    // Layers past the reused ones are from other corners
+    auto name = entry.path().filename().string();
+    if (name.rfind("layer", 0) == 0 &&
+        std::stoul(name.substr(5)) > reused)
+      std::filesystem::remove(entry.path());
+  }
+  std::ofstream angles_f(dir / "angles.json");
+  angles_f << angles;
+  angles_f.close();
+  std::ofstream options_f(dir / "options.json");
+  options_f << options;
+  options_f.close();
+}
+
+void write_layer(
+    const std::string &out, size_t k, const SofaBranchTree &tree) {
+  // Renamed, so that an interrupted write leaves no partial layer
+  std::string path = layer_path(out, k);
+  std::string tmp = path + ".tmp";
+  CerealWriter writer(tmp.c_str());
+  writer << tree.ctx << tree;
+  writer.close();
+  std::filesystem::rename(tmp, path);
+}
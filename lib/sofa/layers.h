@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <json/json.h>
+
+#include "branch_tree.h"
+
+// Trees after each corner of a run of sbranch, kept in <out>.layers/
+// so that a later run sharing a prefix of corners restarts from there.
+// layer<k>.crl is the tree after the first k corners, and angles.json
+// and options.json describe the run the layers come from.
+
+// Directory of the layers of the tree `path`
+std::string layers_path(const std::string &path);
+std::string layer_path(const std::string &path, size_t k);
+
+// Corners (index, extend) of `angles` in branching order
+std::vector< std::pair<int, bool> > branch_corners(const Json::Value &angles);
+
+// Number of corners of the longest layer of `prev` to restart the run of
+// `angles` with `options` from, or 0 to start from the root
+size_t reusable_prefix(
+    const std::string &prev,
+    const Json::Value &angles,
+    const Json::Value &options);
+
+// Prepares the layers of `out` for the run of `angles` with `options`,
+// after the first `reused` layers of `prev`
+void start_layers(
+    const std::string &out, const std::string &prev,
+    const Json::Value &angles, const Json::Value &options,
+    size_t reused);
+
+// Writes the tree after the first `k` corners to the layers of `out`
+void write_layer(
+    const std::string &out, size_t k, const SofaBranchTree &tree);
@@ -0,0 +1,211 @@
+#include "leaf_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "json.h"
+
+std::string form_key(const LinearForm &f) {
+  std::string res = to_json(f.w0()).asString();
+  for (const auto &w : f.w1())
+    res += " " + to_json(w).asString();
+  return res;
+}
+
+std::string file_hash(const std::string &path, size_t size) {
+  uint64_t h = 14695981039346656037ULL;
+  std::ifstream in(path, std::ios::binary);
+  std::vector<char> buf(1 << 20);
+  while (size > 0 && in) {
+    in.read(buf.data(), std::streamsize(std::min(size, buf.size())));
+    auto n = size_t(in.gcount());
+    for (size_t k = 0; k < n; k++) {
+      h ^= uint8_t(buf[k]);
+      h *= 1099511628211ULL;
+    }
+    size -= n;
+    if (n == 0)
+      break;
+  }
+  std::stringstream res;
+  res << std::hex << h;
+  return res.str();
+}
+
+// Number in `val`, if it is one. Unlike `qt_from_json`, a file may
+// hold anything here
+static std::optional<QT> qt_of(const Json::Value &val) {
+  if (!val.isString())
+    return std::nullopt;
+  std::istringstream buf(val.asString());
+  QT res;
+  buf >> res;
+  if (buf.fail() || !buf.eof())
+    return std::nullopt;
+  return res;
+}
+
+static Json::Value form_json(const LinearForm &g) {
+  Json::Value res(Json::objectValue);
+  res["w0"] = to_json(g.w0());
+  res["w1"] = to_json(g.w1());
+  return res;
+}
+
+std::optional<LeafBound> LeafCache::get(
+    const SofaState &v, const SofaQPSetup &setup, const LinearForm &g) {
+  auto [f, c] = direction(g);
+  if (c == 0)
+    return std::nullopt;
+  Key key{v.id_string(), form_key(f)};
+
+  // A loaded bound is checked once, by the first thread to take it
+  std::optional<LeafBound> loaded;
+  {
+    std::unique_lock<std::shared_mutex> guard(lock_);
+    auto it = loaded_.find(key);
+    if (it != loaded_.end()) {
+      loaded = std::move(it->second);
+      loaded_.erase(it);
+    }
+  }
+  if (loaded && verify_(v, setup, key.second, *loaded)) {
+    std::unique_lock<std::shared_mutex> guard(lock_);
+    merge_(bounds_, key, *loaded);
+  }
+
+  std::shared_lock<std::shared_mutex> guard(lock_);
+  auto it = bounds_.find(key);
+  if (it == bounds_.end())
+    return std::nullopt;
+  // From the minimum of f to that of g
+  auto to_g = [&](const QT &x) { return g.w0() + c * x; };
+  LeafBound res = it->second;
+  res.lower = to_g(res.lower);
+  if (res.upper)
+    res.upper = to_g(*res.upper);
+  if (res.witness)
+    res.witness = to_g(*res.witness);
+  return res;
+}
+
+void LeafCache::put(const SofaState &v, const LinearForm &g, LeafBound b) {
+  auto [f, c] = direction(g);
+  if (c == 0)
+    return;
+  auto to_f = [&](const QT &x) { return (x - g.w0()) / c; };
+  b.lower = to_f(b.lower);
+  if (b.upper)
+    b.upper = to_f(*b.upper);
+  if (b.witness)
+    b.witness = to_f(*b.witness);
+  // The certificate is of g, so it says so
+  if (!b.certificate.isNull())
+    b.certificate["form"] = form_json(g);
+  std::unique_lock<std::shared_mutex> guard(lock_);
+  merge_(bounds_, {v.id_string(), form_key(f)}, b);
+}
+
+void LeafCache::load(const std::string &path, const std::string &tree) {
+  std::ifstream in(path);
+  if (!in)
+    return;
+  Json::Value doc;
+  in >> doc;
+  if (doc["tree"].asString() != tree)
+    return;
+  std::unique_lock<std::shared_mutex> guard(lock_);
+  for (const auto &e : doc["bounds"]) {
+    auto lower = qt_of(e["lower"]);
+    if (!lower || !e["certificate"].isObject())
+      continue;
+    // The witness is not certified, so it is found again
+    LeafBound b{*lower, qt_of(e["upper"]), std::nullopt, e["certificate"]};
+    merge_(loaded_, {e["leaf"].asString(), e["form"].asString()}, b);
+  }
+}
+
+void LeafCache::save(const std::string &path, const std::string &tree) const {
+  Json::Value doc(Json::objectValue);
+  doc["tree"] = tree;
+  doc["bounds"] = Json::Value(Json::arrayValue);
+  {
+    std::shared_lock<std::shared_mutex> guard(lock_);
+    // Loaded bounds not used in this run are kept unchecked
+    for (const auto *bounds : {&bounds_, &loaded_}) {
+      for (const auto &[key, b] : *bounds) {
+        if (b.certificate.isNull())
+          continue;
+        Json::Value e(Json::objectValue);
+        e["leaf"] = key.first;
+        e["form"] = key.second;
+        e["lower"] = to_json(b.lower);
+        if (b.upper)
+          e["upper"] = to_json(*b.upper);
+        e["certificate"] = b.certificate;
+        doc["bounds"].append(e);
+      }
+    }
+  }
+  // Replaced at once, so that an interrupted write loses nothing
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp);
+    out << doc;
+  }
+  std::filesystem::rename(tmp, path);
+}
+
+void LeafCache::merge_(
+    std::map<Key, LeafBound> &bounds, const Key &key, const LeafBound &b) {
+  auto it = bounds.find(key);
+  if (it == bounds.end()) {
+    bounds.emplace(key, b);
+    return;
+  }
+  auto &c = it->second;
+  if (b.lower > c.lower) {
+    c.lower = b.lower;
+    c.certificate = b.certificate;
+  }
+  if (b.upper && (!c.upper || *b.upper < *c.upper))
+    c.upper = b.upper;
+  if (b.witness && (!c.witness || *b.witness < *c.witness))
+    c.witness = b.witness;
+}
+
+bool LeafCache::verify_(
+    const SofaState &v, const SofaQPSetup &setup,
+    const std::string &key, const LeafBound &b) {
+  // The certificate is the `StateBound` of a form g of the direction
+  const auto &cert = b.certificate;
+  const auto &form = cert["form"];
+  auto t = qt_of(cert["t"]);
+  auto w0 = qt_of(form["w0"]);
+  if (!t || *t <= 0 || !w0 || !form["w1"].isArray() ||
+      int(form["w1"].size()) != setup.area.d())
+    return false;
+  std::vector<QT> w1;
+  for (const auto &w : form["w1"]) {
+    auto x = qt_of(w);
+    if (!x)
+      return false;
+    w1.push_back(*x);
+  }
+  LinearForm g(*w0, w1);
+  auto [f, c] = direction(g);
+  if (c == 0 || form_key(f) != key)
+    return false;
+
+  // Solved again, so that only the leaf and t are trusted:
+  // max(area - t * g) = H  =>  g >= (2.2195 - H) / t
+  auto res = v.penalized_area(setup, g, *t);
+  if (!res.is_optimal())
+    return false;
+  QT lower = (QT(22195, 10000) - res.optimality_proof().max_area) / *t;
+  return b.lower <= (lower - g.w0()) / c;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <map>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+
+#include <json/json.h>
+
+#include "number.h"
+#include "forms.h"
+#include "state.h"
+
+// What is known of the minimum of a form over a leaf:
+// it is proven at least `lower`, and at most `upper` if found
+struct LeafBound {
+  QT lower;
+  std::optional<QT> upper;
+  // Value of the form at a sofa of the leaf, and the certificate
+  // of `lower` (from `min_over_state` only)
+  std::optional<QT> witness;
+  Json::Value certificate;
+};
+
+// Key of a form in a LeafCache
+std::string form_key(const LinearForm &f);
+
+// FNV-1a of the first `size` bytes of the file `path`
+std::string file_hash(const std::string &path, size_t size);
+
+// Bounds of leaves found by earlier queries, by leaf ID and form,
+// so that a later query skips the leaves they already settle.
+// A form g is kept as w0 + c * f for a direction f with the first nonzero
+// coefficient 1 or -1, so that shifts and positive multiples share bounds.
+// Only bounds with a certificate are saved, and a loaded bound is used
+// once its certificate is checked against the leaf.
+class LeafCache {
+  public:
+    // Bound of `g` over the leaf `v`, if kept
+    std::optional<LeafBound> get(
+        const SofaState &v, const SofaQPSetup &setup,
+        const LinearForm &g);
+    // Keeps the better of both ends
+    void put(const SofaState &v, const LinearForm &g, LeafBound b);
+
+    // Reads the bounds kept in `path` for the tree of hash `tree`,
+    // if the file is there and of the same tree
+    void load(const std::string &path, const std::string &tree);
+    // Writes the bounds with a certificate to `path` for the tree of
+    // hash `tree`
+    void save(const std::string &path, const std::string &tree) const;
+
+  private:
+    using Key = std::pair<std::string, std::string>;
+    mutable std::shared_mutex lock_;
+    std::map<Key, LeafBound> bounds_;
+    // Bounds of `load` whose certificates are not checked yet
+    std::map<Key, LeafBound> loaded_;
+
+    // Keeps the better of both ends of `b` and the bound of `key`
+    static void merge_(std::map<Key, LeafBound> &bounds,
+                       const Key &key, const LeafBound &b);
+    // Whether the certificate of `b`, the bound of direction `key`
+    // over `v`, proves its lower end
+    static bool verify_(
+        const SofaState &v, const SofaQPSetup &setup,
+        const std::string &key, const LeafBound &b);
+};
@@ -2,6 +2,7 @@
 
 #include "expect.h"
 #include "qform.h"
+#include "thread_pool.h"
 
 LinearForm::LinearForm() = default;
 
@@ -146,12 +147,17 @@ LinearForm &LinearForm::normalize() {
   return *this;
 }
 
-QT LinearForm::operator()(std::vector<QT> v) const {
+QT LinearForm::operator()(const std::vector<QT> &v) const {
   expect(int(v.size()) == d_);
 
   QT res = w0_;
-  for (int i = 0; i < d_; i++)
-    res += w1_[i] * v[i];
+  // Keeps its GMP memory between calls
+  QT &term = thread_scratch<QT>();
+  for (int i = 0; i < d_; i++) {
+    term = w1_[i];
+    term *= v[i];
+    res += term;
+  }
 
   return res;
 }
@@ -160,3 +166,15 @@ LinearForm operator*(const QT &c, const LinearForm &f) {
   return f * c;
 }
 
+std::pair<LinearForm, QT> direction(const LinearForm &f) {
+  LinearForm res(f);
+  res.w0() = QT(0);
+  for (const auto &w : res.w1()) {
+    if (w != 0) {
+      QT c = w < 0 ? -w : w;
+      res /= c;
+      return {res.normalize(), c};
+    }
+  }
+  return {res, QT(0)};
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <utility>
 #include <vector>
 
 #include "number.h"
@@ -50,7 +51,7 @@ class LinearForm {
     LinearForm &normalize();
 
     // Substitution
-    QT operator()(std::vector<QT> values) const;
+    QT operator()(const std::vector<QT> &values) const;
 
     // Serialization
     // Only this function can change the dimension d()
@@ -64,3 +65,7 @@ class LinearForm {
 
 // Arithmetic
 LinearForm operator*(const QT &c, const LinearForm &f);
+
+// Positive multiple of `f` without the constant term, with the first
+// nonzero coefficient 1 or -1, and the multiple (0 for a constant form)
+std::pair<LinearForm, QT> direction(const LinearForm &f);
@@ -1,19 +1,33 @@
 #include "parse.h"
 
+#include <cassert>
+#include <cctype>
 #include <cstring>
 #include <string>
 #include <exception>
+#include <stdexcept>
 
 Parser::Parser(const SofaContext &ctx) : ctx(ctx) {}
 
 LinearForm Parser::parse_expr(const std::string &str) {
   p_ = str.c_str();
-  return length_sum_();
+  LinearForm res = length_sum_();
+  end_();
+  return res;
 }
 
 LinearInequality Parser::parse_ineq(const std::string &str) {
   p_ = str.c_str();
-  return ineq_();
+  LinearInequality res = ineq_();
+  end_();
+  return res;
+}
+
+void Parser::end_() {
+  while (isspace((unsigned char)*p_))
+    p_++;
+  if (*p_ != '\0')
+    throw std::runtime_error(std::string("Unexpected ") + p_);
 }
 
 void Parser::expect_(const char * const str) {
@@ -53,6 +67,15 @@ int Parser::id_() {
     id = 10 * id + (int(*p_) - int('0'));
   }
 
+  return negate ? -id : id;
+}
+
+int Parser::id_in_(int lo, int hi) {
+  int id = id_();
+  if (id < lo || id > hi)
+    throw std::out_of_range(
+        "Index " + std::to_string(id) + " out of range [" +
+        std::to_string(lo) + ", " + std::to_string(hi) + "]");
   return id;
 }
 
@@ -61,6 +84,8 @@ QT Parser::num_() {
   if (*p_ == '/') {
     p_++;
     int denom = id_();
+    if (denom == 0)
+      throw std::domain_error("Zero denominator");
     return QT{numer, denom};
   } else {
     return QT{numer};
@@ -71,28 +96,30 @@ LinearFormPoint Parser::point_() {
   if (*p_ == 'A') {
     p_++;
     expect_("(");
-    int id = id_();
+    int id = id_in_(0, 2 * ctx.n() + 1);
     expect_(")");
     return ctx.A(id);
   } else if (*p_ == 'C') {
     p_++;
     expect_("(");
-    int id = id_();
+    int id = id_in_(-ctx.n() - 1, ctx.n());
     expect_(")");
     return ctx.C(id);
   } else if (*p_ == 'x') {
     p_++;
     expect_("(");
-    int id = id_();
+    int id = id_in_(0, ctx.n());
     expect_(")");
     return ctx.x(id);
   } else if (*p_ == 'p') {
     p_++;
     expect_("(");
-    int id0 = id_();
+    int id0 = id_in_(-ctx.n() + 1, ctx.n() - 1);
     expect_(",");
-    int id1 = id_();
+    int id1 = id_in_(-ctx.n() + 1, ctx.n() - 1);
     expect_(")");
+    if (id0 == id1)
+      throw std::out_of_range("p of a line with itself");
     return ctx.p(id0, id1);
   } else {
     throw std::runtime_error("A,C,x,p expected for point");
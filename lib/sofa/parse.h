@@ -3,10 +3,10 @@
 
 #include <string>
 
-#include "sofa/number.h"
-#include "sofa/forms.h"
-#include "sofa/ineq.h"
-#include "sofa/context.h"
+#include "number.h"
+#include "forms.h"
+#include "ineq.h"
+#include "context.h"
 
 // <id> is an integer
 //
@@ -41,8 +41,12 @@ class Parser {
     const char *p_;
 
     void expect_(const char * const str);
+    // Throws unless only spaces are left
+    void end_();
     
     int id_();
+    // Integer in [lo, hi]
+    int id_in_(int lo, int hi);
     QT num_();
 
     LinearFormPoint point_();
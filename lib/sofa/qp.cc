@@ -71,8 +71,8 @@ Json::Value SofaAreaOptimalityProof::json() const {
 
   res["max_area"] = to_json(max_area);
   res["maximizer"] = to_json(maximizer);
-  res["quadratic_l"] = to_json(l);
-  res["quadratic_d"] = to_json(d);
+  res["quadratic_l"] = to_json(ldl->l);
+  res["quadratic_d"] = to_json(ldl->d);
 
   auto &res_lambdas = res["lambdas"];
   for (auto const &[ineq, lambda] : lambdas) {
@@ -114,9 +114,21 @@ SofaAreaResult sofa_area_qp(
     const SofaContext &ctx,
     SofaConstraints ineqs,
     const std::vector<LinearInequality> &extra_ineqs) {
+  auto negdef_proof = is_negative_semidefinite(q.w2());
+  expect(negdef_proof);
+  return sofa_area_qp(
+      q, std::make_shared<const CholeskyLDL>(std::move(negdef_proof.value())),
+      ctx, std::move(ineqs), extra_ineqs);
+}
+
+SofaAreaResult sofa_area_qp(
+    const QuadraticForm &q, 
+    std::shared_ptr<const CholeskyLDL> negdef_proof,
+    const SofaContext &ctx,
+    SofaConstraints ineqs,
+    const std::vector<LinearInequality> &extra_ineqs) {
 
   expect(q.d() == ctx.d());
-  auto negdef_proof = is_negative_semidefinite(q.w2());
   expect(negdef_proof);
 
   int n = q.d();
@@ -259,8 +271,7 @@ SofaAreaResult sofa_area_qp(
     return {SofaAreaOptimalityProof{ 
       (-sol.objective_value() / d).normalize(),
       std::vector<QT>(sol.variable_values_begin(), sol.variable_values_end()),
-      negdef_proof.value().l,
-      negdef_proof.value().d,
+      negdef_proof,
       lambdas,
       lambdas_extra
     }};
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <map>
+#include <memory>
 #include <iostream>
 #include <utility>
 #include <optional>
@@ -27,8 +28,8 @@ std::optional<CholeskyLDL> is_negative_semidefinite(const QTMatrix &mat);
 struct SofaAreaOptimalityProof {
   QT max_area;
   std::vector<QT> maximizer;
-  QTMatrix l;
-  std::vector<QT> d;
+  // Depends only on the area form, so shared between proofs
+  std::shared_ptr<const CholeskyLDL> ldl;
   std::map<SofaConstraintProbe, QT> lambdas;
   std::map<int, QT> lambdas_extra;
 
@@ -70,3 +71,11 @@ SofaAreaResult sofa_area_qp(
     const SofaContext &ctx,
     SofaConstraints cons,
     const std::vector<LinearInequality> &extra_ineqs = {});
+
+// Same as above, with the proof `nsd` that `area` is negative semidefinite
+SofaAreaResult sofa_area_qp(
+    const QuadraticForm &area,
+    std::shared_ptr<const CholeskyLDL> nsd,
+    const SofaContext &ctx,
+    SofaConstraints cons,
+    const std::vector<LinearInequality> &extra_ineqs = {});
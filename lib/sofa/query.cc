@@ -0,0 +1,254 @@
+#include "query.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#include "tqdm.h"
+
+#include "json.h"
+#include "bound.h"
+#include "thread_pool.h"
+
+Json::Value QueryResult::json(const Query &q) const {
+  Json::Value res(Json::objectValue);
+  res["value"] = q.expr;
+  res["bound"] = q.lb ? "lb" : "ub";
+  res["min"] = to_json(q.min);
+  res["max"] = to_json(q.max);
+  if (error) {
+    res["error"] = *error;
+    return res;
+  }
+  res["result"] = to_json(bound);
+  if (witness)
+    res["witness"] = to_json(*witness);
+  return res;
+}
+
+LeafBound bound_leaf(
+    const SofaState &v, const SofaQPSetup &setup,
+    const LinearForm &g, const Search &search, const QueryOptions &options) {
+  const auto &q = search.query;
+  auto current = [&]() {
+    QT res = search.incumbent.get();
+    return q.lb ? res : -res;
+  };
+  QT res = current();
+  // Whether a sofa of the leaf has g at most `bound`
+  auto reaches = [&](const QT &bound) {
+    return bool(v.is_compatible(setup, {g <= bound}));
+  };
+  if (!reaches(res))
+    return {res, std::nullopt, std::nullopt, Json::Value()};
+
+  if (options.exact) {
+    QT tol = (q.max - q.min) / QT(NT(1) << options.bsearch_depth);
+    int max_qps = 2 * options.bsearch_depth + 2;
+    auto sb = min_over_state(v, setup, g, tol, max_qps);
+    return {sb.lower, sb.witness, sb.witness, sb.json()};
+  }
+
+  // Refine on the grid of [min, max] in terms of g, so that the result
+  // does not depend on the order the threads reach the leaves
+  bool res_found = false;
+  QT clb = q.lb ? q.min : -q.max, cub = q.lb ? q.max : -q.min;
+  std::optional<QT> upper = res;
+  for (int i = 0; i < options.bsearch_depth; i++) {
+    // Stop once this leaf can't improve the bound
+    if (res_found && clb >= res)
+      break;
+    QT md = (clb + cub) / 2;
+    if (!reaches(md)) {
+      res_found = true;
+      clb = md;
+    } else {
+      cub = md;
+      upper = md;
+    }
+    res = current();
+  }
+  if (!res_found)
+    throw std::runtime_error("Bound invalid");
+  return {clb, upper, std::nullopt, Json::Value()};
+}
+
+void refine(
+    const SofaState &v, const SofaQPSetup &setup,
+    Search &search, const QueryOptions &options, LeafCache *cache) {
+  const auto &q = search.query;
+  // Work with the minimum of g in both cases
+  LinearForm g = q.lb ? q.val : -q.val;
+  auto to_g = [&](const QT &x) { return q.lb ? x : -x; };
+  QT tol = (q.max - q.min) / QT(NT(1) << options.bsearch_depth);
+  QT res = to_g(search.incumbent.get());
+
+  std::optional<LeafBound> b;
+  if (cache)
+    b = cache->get(v, setup, g);
+  if (b && b->lower >= res)
+    return;
+  if (!b || !b->upper || *b->upper - b->lower > tol) {
+    b = bound_leaf(v, setup, g, search, options);
+    if (cache) {
+      cache->put(v, g, *b);
+      // Better ends of earlier runs, if kept
+      if (auto cached = cache->get(v, setup, g))
+        b = cached;
+    }
+  }
+
+  bool improved = search.incumbent.improve(to_g(b->lower));
+  std::lock_guard<std::mutex> guard(search.lock);
+  if (improved && !b->certificate.isNull())
+    search.certificates[v.id_string()] = b->certificate;
+  if (b->witness) {
+    QT witness = to_g(*b->witness);
+    if (!search.witness ||
+        (q.lb ? witness < *search.witness : witness > *search.witness))
+      search.witness = witness;
+  }
+}
+
+bool is_settled(const TreeIndex &index, size_t leaf, const Search &search) {
+  const auto &q = search.query;
+  QT res = search.incumbent.get();
+  return q.lb ? index.lower(leaf, q.val) >= res :
+                -index.lower(leaf, -q.val) <= res;
+}
+
+bool is_symmetry_broken(const SofaBranchTree &tree) {
+  const auto &ctx = tree.ctx;
+  const auto &nodes = tree.valid_states();
+  if (!ctx.is_symmetric() || nodes.empty())
+    return false;
+  for (const auto &v : nodes) {
+    auto conds = v.conds();
+    if (std::find(conds.begin(), conds.end(), ctx.symmetry_probe()) ==
+        conds.end())
+      return false;
+  }
+  return true;
+}
+
+std::vector<size_t> hardest_first(
+    const std::vector<SofaState> &nodes, std::deque<Search> &searches,
+    const QueryOptions &options) {
+  const QT c(22195, 10000);
+  size_t n = nodes.size();
+  std::vector<size_t> order(n), rank(n, n);
+  std::vector<QT> values(n);
+  for (auto &search : searches) {
+    const auto &q = search.query;
+    thread_pool().run(options.nthreads, [&](int rnk) {
+      for (size_t i = rnk; i < n; i += options.nthreads)
+        values[i] = q.val(nodes[i].last_vars());
+    });
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return q.lb ? values[a] < values[b] : values[a] > values[b];
+    });
+    for (size_t j = 0; j < n; j++)
+      rank[order[j]] = std::min(rank[order[j]], j);
+    if (n == 0)
+      continue;
+
+    // Any start gives a valid bound, and none better than this value
+    const QT &seed = values[order[0]];
+    if (q.min <= seed && seed <= q.max)
+      search.incumbent.improve(seed);
+    // The value is attained by a sofa only at an area of at least c
+    const auto &v = nodes[order[0]];
+    if (v.last_area() >= c)
+      search.witness = seed;
+  }
+
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return rank[a] < rank[b];
+  });
+  return order;
+}
+
+std::vector<QueryResult> answer(
+    const SofaBranchTree &tree, bool mirrored, const TreeIndex *index,
+    const std::vector<Query> &queries,
+    const QueryOptions &options, LeafCache *cache) {
+  const auto &nodes = tree.valid_states();
+
+  std::deque<Search> searches;
+  for (size_t k = 0; k < queries.size(); k++) {
+    searches.emplace_back(k, queries[k]);
+    if (mirrored) {
+      Query q = queries[k];
+      q.val = tree.ctx.mirror_form(q.val);
+      searches.emplace_back(k, q);
+    }
+  }
+
+  auto order = hardest_first(nodes, searches, options);
+
+  tqdm bar;
+  thread_pool().run(options.nthreads, [&](int rnk) {
+    int c = 0, n = (int(nodes.size()) - 1) / options.nthreads + 1;
+    for (size_t j = rnk; j < nodes.size(); j += options.nthreads) {
+      size_t i = order[j];
+      if (rnk == 0 && options.progress)
+        bar.progress(c++, n);
+      std::optional<SofaQPSetup> setup;
+      for (auto &search : searches) {
+        if (search.failed || (index && is_settled(*index, i, search)))
+          continue;
+        if (!setup)
+          setup = nodes[i].qp_setup();
+        try {
+          refine(nodes[i], *setup, search, options, cache);
+        } catch (std::exception &e) {
+          std::lock_guard<std::mutex> guard(search.lock);
+          if (!search.failed)
+            search.error = e.what();
+          search.failed = true;
+        }
+      }
+    }
+  });
+  if (options.progress)
+    bar.finish();
+
+  std::vector<QueryResult> res(queries.size());
+  for (auto &r : res)
+    r.certificates = Json::Value(Json::objectValue);
+  std::vector<bool> seen(queries.size(), false);
+  for (auto &search : searches) {
+    bool lb = search.query.lb;
+    auto &r = res[search.index];
+    QT bound = search.incumbent.get();
+    if (!seen[search.index] || (lb ? bound < r.bound : bound > r.bound))
+      r.bound = bound;
+    const auto &w = search.witness;
+    if (w && (!r.witness || (lb ? *w < *r.witness : *w > *r.witness)))
+      r.witness = w;
+    for (const auto &name : search.certificates.getMemberNames())
+      r.certificates[name].append(search.certificates[name]);
+    if (search.failed && !r.error)
+      r.error = search.error;
+    seen[search.index] = true;
+  }
+  return res;
+}
+
+Json::Value count_compatible(
+    const SofaBranchTree &tree, const LinearInequality &ineq,
+    const QueryOptions &options) {
+  const auto &nodes = tree.valid_states();
+  std::atomic<size_t> count(0);
+  thread_pool().run(options.nthreads, [&](int rnk) {
+    for (size_t i = rnk; i < nodes.size(); i += options.nthreads)
+      if (nodes[i].is_compatible({ineq}))
+        count++;
+  });
+  Json::Value res(Json::objectValue);
+  res["compatible"] = Json::UInt64(count.load());
+  res["leaves"] = Json::UInt64(nodes.size());
+  return res;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "number.h"
+#include "forms.h"
+#include "state.h"
+#include "branch_tree.h"
+#include "tree_index.h"
+#include "leaf_cache.h"
+
+// A bound to find over the leaves: the lower or upper bound of `val`,
+// searched within [min, max]
+struct Query {
+  std::string expr;
+  LinearForm val;
+  bool lb;
+  QT min, max;
+};
+
+// How the leaves are bounded for a query
+struct QueryOptions {
+  // Lagrangian relaxation instead of binary search, stopping once a bound
+  // is within the precision of `bsearch_depth` of a sofa attaining it
+  bool exact;
+  int bsearch_depth;
+  int nthreads;
+  bool progress;
+};
+
+// Best bound found so far, shared by the threads.
+// Reads take a short shared lock for a snapshot, and the bound
+// only moves through `improve`, so no lock is held during a QP.
+class Incumbent {
+  public:
+    Incumbent(bool lb, const QT &start) : lb_(lb), res_(start) {}
+
+    QT get() const {
+      std::shared_lock<std::shared_mutex> guard(lock_);
+      return res_;
+    }
+
+    // Moves the bound to `v` if it is better, and returns whether it did
+    bool improve(const QT &v) {
+      std::unique_lock<std::shared_mutex> guard(lock_);
+      if (lb_ ? v < res_ : v > res_) {
+        res_ = v;
+        return true;
+      }
+      return false;
+    }
+
+  private:
+    const bool lb_;
+    mutable std::shared_mutex lock_;
+    QT res_;
+};
+
+// Search of a query over the leaves.
+// The form of a query is searched once as is, and once mirrored
+// if the leaves only cover sofas up to reflection.
+struct Search {
+  // Index of the query, and the query with the form searched
+  size_t index;
+  Query query;
+  Incumbent incumbent;
+  // Value of the form at a sofa, as close to the bound as found
+  // and certificates of the leaves that moved the bound (exact only)
+  std::mutex lock;
+  std::optional<QT> witness;
+  Json::Value certificates;
+  // Set with the first error of a leaf, after which the search stops
+  std::atomic<bool> failed;
+  std::string error;
+
+  Search(size_t index, const Query &query) :
+    index(index), query(query),
+    incumbent(query.lb, query.lb ? query.max : query.min),
+    certificates(Json::objectValue), failed(false) {}
+};
+
+// Result of a query: the worst bound out of its searches,
+// or the error of one of them
+struct QueryResult {
+  QT bound;
+  std::optional<QT> witness;
+  Json::Value certificates;
+  std::optional<std::string> error;
+
+  Json::Value json(const Query &q) const;
+};
+
+// Bound of the minimum of `g` over the leaf `v` beyond the bound of
+// `search`, or just that it is at least the bound if so.
+// For the lower bound g is the form of the query, otherwise its negation.
+// Throws if a binary search finds no bound within [min, max].
+LeafBound bound_leaf(
+    const SofaState &v, const SofaQPSetup &setup,
+    const LinearForm &g, const Search &search, const QueryOptions &options);
+
+// Moves the bound of `search` past the leaf `v`,
+// if the leaf has a sofa beyond the bound.
+// With a cache, bounds of the leaf from earlier queries are reused.
+void refine(
+    const SofaState &v, const SofaQPSetup &setup,
+    Search &search, const QueryOptions &options, LeafCache *cache);
+
+// Whether the interval bound of the `leaf`-th leaf in `index`
+// shows that it can't move the bound of `search`
+bool is_settled(const TreeIndex &index, size_t leaf, const Search &search);
+
+// Whether the leaves only cover one out of each sofa and its reflection
+bool is_symmetry_broken(const SofaBranchTree &tree);
+
+// Order to refine the leaves in: those whose last maximizer is the most
+// extreme for some search come first, so that the bound moves early and
+// later leaves mostly pass a single check at the final bound.
+// Seeds the bound and the witness of each search from the maximizers.
+std::vector<size_t> hardest_first(
+    const std::vector<SofaState> &nodes, std::deque<Search> &searches,
+    const QueryOptions &options);
+
+// Answers every query in one pass over the leaves of `tree`.
+// The QP setup of a leaf is shared by the queries.
+// If the leaves are `mirrored`, the reflections of the leaves are
+// bounded by bounding the mirrored form over the leaves.
+// With an index, leaves whose interval bound already settles a query
+// skip its QPs. A query that fails gets its error, and the others
+// are answered all the same.
+std::vector<QueryResult> answer(
+    const SofaBranchTree &tree, bool mirrored, const TreeIndex *index,
+    const std::vector<Query> &queries,
+    const QueryOptions &options, LeafCache *cache = nullptr);
+
+// Number of leaves of `tree` compatible with `ineq`
+Json::Value count_compatible(
+    const SofaBranchTree &tree, const LinearInequality &ineq,
+    const QueryOptions &options);
@@ -0,0 +1,110 @@
+#include "server.h"
+
+#include <sstream>
+#include <stdexcept>
+
+#include "json.h"
+
+void check_bsearch_depth(int depth) {
+  if (depth < 1 || depth > max_bsearch_depth)
+    throw std::invalid_argument(
+        "bsearch-depth should be in [1, " +
+        std::to_string(max_bsearch_depth) + "]");
+}
+
+// Number `str` of a request, which unlike `stoq` may be anything
+static QT parse_number(const std::string &str) {
+  // A zero denominator would not be caught by the stream
+  auto slash = str.find('/');
+  if (slash != std::string::npos &&
+      (str.find_first_not_of("0123456789", slash + 1) != std::string::npos ||
+       str.find_first_not_of('0', slash + 1) == std::string::npos))
+    throw std::invalid_argument("Number expected, got '" + str + "'");
+  std::istringstream buf(str);
+  QT res;
+  buf >> res;
+  if (str.empty() || buf.fail() || !buf.eof())
+    throw std::invalid_argument("Number expected, got '" + str + "'");
+  return res;
+}
+
+static int parse_int(const std::string &str) {
+  std::istringstream buf(str);
+  int res;
+  buf >> res;
+  if (str.empty() || buf.fail() || !buf.eof())
+    throw std::invalid_argument("Integer expected, got '" + str + "'");
+  return res;
+}
+
+QueryServer::QueryServer(
+    const SofaBranchTree &tree, bool mirrored,
+    const TreeIndex *index, LeafCache &cache,
+    const QueryOptions &options) :
+  tree_(tree), mirrored_(mirrored), index_(index), cache_(cache),
+  options_(options), parser_(tree.ctx) {}
+
+Json::Value QueryServer::reply(const std::string &line) {
+  std::stringstream sin(line);
+  std::string cmd;
+  sin >> cmd;
+
+  Json::Value res(Json::objectValue);
+  try {
+    if (cmd == "lb" || cmd == "ub") {
+      std::string min_str, max_str, expr;
+      sin >> min_str >> max_str;
+      std::getline(sin >> std::ws, expr);
+      QT min = parse_number(min_str), max = parse_number(max_str);
+      if (min > max)
+        throw std::invalid_argument("MIN should be at most MAX");
+      Query q{expr, parser_.parse_expr(expr), cmd == "lb", min, max};
+      res = answer(
+          tree_, mirrored_, index_, {q}, options_, &cache_)[0].json(q);
+    } else if (cmd == "compatible") {
+      std::string ineq;
+      std::getline(sin >> std::ws, ineq);
+      res = count_compatible(tree_, parser_.parse_ineq(ineq), options_);
+      res["ineq"] = ineq;
+    } else if (cmd == "set") {
+      std::string name, value;
+      sin >> name >> value;
+      if (name == "exact") {
+        if (value != "on" && value != "off")
+          throw std::invalid_argument("exact should be on or off");
+        options_.exact = value == "on";
+      } else if (name == "bsearch-depth") {
+        int depth = parse_int(value);
+        check_bsearch_depth(depth);
+        options_.bsearch_depth = depth;
+      } else {
+        throw std::invalid_argument("Unknown setting " + name);
+      }
+      res["exact"] = options_.exact;
+      res["bsearch-depth"] = options_.bsearch_depth;
+    } else {
+      throw std::invalid_argument("Unknown command " + cmd);
+    }
+  } catch (std::exception &e) {
+    res = Json::Value(Json::objectValue);
+    res["error"] = e.what();
+  }
+  return res;
+}
+
+void QueryServer::serve(std::istream &in, std::ostream &out) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+
+  std::string line;
+  while (std::getline(in, line)) {
+    std::stringstream sin(line);
+    std::string cmd;
+    sin >> cmd;
+    if (cmd.empty())
+      continue;
+    if (cmd == "quit")
+      break;
+    out << Json::writeString(builder, reply(line)) << std::endl;
+  }
+}
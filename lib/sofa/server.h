@@ -0,0 +1,47 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+#include <json/json.h>
+
+#include "branch_tree.h"
+#include "tree_index.h"
+#include "leaf_cache.h"
+#include "query.h"
+#include "parse.h"
+
+// Largest depth of a binary search, past which the QPs cost more than
+// any bound is worth
+const int max_bsearch_depth = 64;
+
+// Throws std::invalid_argument unless 1 <= depth <= max_bsearch_depth
+void check_bsearch_depth(int depth);
+
+// Answers queries over a loaded tree, one line at a time:
+//   lb|ub MIN MAX VALUE
+//   compatible INEQ
+//   set exact on|off, set bsearch-depth N
+// Bounds of the leaves are kept in `cache` between queries.
+class QueryServer {
+  public:
+    QueryServer(const SofaBranchTree &tree, bool mirrored,
+                const TreeIndex *index, LeafCache &cache,
+                const QueryOptions &options);
+
+    // JSON reply to `line`, {"error": ...} if it is not understood
+    // or fails
+    Json::Value reply(const std::string &line);
+    // Writes to `out` the reply to each line of `in`, one per line,
+    // until it ends or reads `quit`
+    void serve(std::istream &in, std::ostream &out);
+
+  private:
+    const SofaBranchTree &tree_;
+    const bool mirrored_;
+    const TreeIndex *index_;
+    LeafCache &cache_;
+    QueryOptions options_;
+    Parser parser_;
+};
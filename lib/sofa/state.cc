@@ -1,6 +1,9 @@
 #include "state.h"
 
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <utility>
 
 #include "json.h"
 #include "expect.h"
@@ -14,7 +17,8 @@ SofaState::SofaState(SofaBranchTree &tree)
       id_(0),
       e_({0}), 
       conds_(ctx.default_constraints()),
-      is_frozen_(false) {
+      is_frozen_(false),
+      is_area_certified_(false) {
   update_();
 }
 
@@ -28,16 +32,33 @@ SofaState::SofaState(const SofaState &s)
       area_(s.area_), 
       vars_(s.vars_),
       is_frozen_(s.is_frozen_),
-      area_result_(s.area_result_) {
+      area_result_(s.area_result_),
+      is_area_certified_(s.is_area_certified_) {
+}
+
+SofaState::SofaState(SofaState &&s) noexcept
+    : ctx(s.ctx), 
+      tree(s.tree),
+      id_(s.id_),
+      is_valid_(s.is_valid_),
+      e_(std::move(s.e_)), 
+      conds_(std::move(s.conds_)), 
+      area_(std::move(s.area_)), 
+      vars_(std::move(s.vars_)),
+      is_frozen_(s.is_frozen_),
+      area_result_(std::move(s.area_result_)),
+      is_area_certified_(s.is_area_certified_) {
 }
 
 SofaState::SofaState(SofaBranchTree &tree, const char *file) 
-    : ctx(tree.ctx), tree(tree), is_frozen_(true) {
+    : ctx(tree.ctx), tree(tree), is_frozen_(true),
+      is_area_certified_(false) {
   load(file, *this);
 }
 
-SofaState::SofaState(SofaBranchTree &tree, CerealReader &reader)
-    : ctx(tree.ctx), tree(tree), is_frozen_(true) {
+SofaState::SofaState(SofaBranchTree &tree, CerealReader &reader, bool frozen)
+    : ctx(tree.ctx), tree(tree), is_frozen_(frozen),
+      is_area_certified_(false) {
   reader >> *this;
 }
 
@@ -49,7 +70,8 @@ SofaState::SofaState(SofaBranchTree &tree, const Json::Value &json) :
     conds_(ints_from_json(json["constraints"])),
     id_(json["id"].asInt()),
     is_frozen_(true),
-    is_valid_(json["valid"].asBool()) {
+    is_valid_(json["valid"].asBool()),
+    is_area_certified_(false) {
 }
 
 bool SofaState::is_valid() const { 
@@ -65,17 +87,32 @@ std::string SofaState::id_string() const {
 }
 
 QT SofaState::area() { 
-  expect(!is_frozen_ && is_valid_);
-  update_();
+  expect(is_valid_);
+  if (!is_area_certified_) {
+    expect(!is_frozen_);
+    update_();
+  }
   return area_; 
 }
 
 std::vector<QT> SofaState::vars() { 
-  expect(!is_frozen_ && is_valid_);
-  update_();
+  area();
   return vars_; 
 }
 
+const SofaAreaOptimalityProof &SofaState::area_proof() {
+  area();
+  return area_result_->optimality_proof();
+}
+
+const std::vector<QT> &SofaState::last_vars() const {
+  return vars_;
+}
+
+const QT &SofaState::last_area() const {
+  return area_;
+}
+
 void SofaState::impose(SofaConstraintProbe cond) {
   if (is_valid_) {
     conds_.push_back(cond);
@@ -109,15 +146,18 @@ SofaState SofaState::split(SofaConstraintProbe ineq) {
   int child_left_id = tree.new_state_id_();
   int child_right_id = tree.new_state_id_();
 
+  // Both children share the constraints so far
+  conds_.share();
   SofaState other(*this);
-  this->impose(ineq);
+  // IDs first, so that a child turning invalid is recorded under its own ID
   this->id_ = child_left_id;
-  other.impose(-ineq);
+  this->impose(ineq);
   other.id_ = child_right_id;
+  other.impose(-ineq);
 
   std::lock_guard<std::mutex> guard(tree.lock_);
-  tree.split_states_.emplace_back(
-    parent_id, ineq, child_left_id, child_right_id);
+  tree.record_split_(
+    SplitState(parent_id, ineq, child_left_id, child_right_id));
 
   return other;
 }
@@ -126,8 +166,12 @@ const std::vector<int> &SofaState::e() const {
   return e_; 
 }
 
-const std::vector<SofaConstraintProbe> &SofaState::conds() const { 
-  return conds_; 
+SofaConstraints SofaState::conds() const { 
+  return conds_.flat(); 
+}
+
+SofaStateKey SofaState::key() const {
+  return SofaStateKey(e_, conds_.flat());
 }
 
 int SofaState::e(int i) const {
@@ -146,14 +190,35 @@ void SofaState::update_e(const std::vector<int> &e) {
   expect(!is_frozen_);
   if (is_valid()) {
     e_ = e;
-    auto narea = (ctx.area(e_))(vars_);
-    expect(area_ >= narea);
-    area_ = narea;
-    if (area_ < QT(22195, 10000)) // Optimization
-      update_();
+    update_area_();
   }
 }
 
+void SofaState::update_e(
+    int first, int last, std::initializer_list<int> edges) {
+  expect(!is_frozen_);
+  expect(0 <= first && first <= last && last <= int(e_.size()));
+  if (is_valid()) {
+    int k = std::min(int(edges.size()), last - first);
+    std::copy(edges.begin(), edges.begin() + k, e_.begin() + first);
+    if (k < last - first)
+      e_.erase(e_.begin() + first + k, e_.begin() + last);
+    else
+      e_.insert(e_.begin() + last, edges.begin() + k, edges.end());
+    update_area_();
+  }
+}
+
+void SofaState::update_area_() {
+  auto narea = (ctx.area(e_))(vars_);
+  expect(area_ >= narea);
+  area_ = narea;
+  // Only a lower bound until solved again
+  is_area_certified_ = false;
+  if (area_ < QT(22195, 10000)) // Optimization
+    update_();
+}
+
 SofaAreaResult SofaState::is_compatible(const LinearInequality &extra_ineq) const {
   return is_compatible(std::vector<LinearInequality>{extra_ineq});
 }
@@ -161,19 +226,43 @@ SofaAreaResult SofaState::is_compatible(const LinearInequality &extra_ineq) cons
 SofaAreaResult SofaState::is_compatible(
     const std::vector<LinearInequality> &extra_ineqs) const {
   // node already invalid by itself
+  // Loaded states keep no proof
   if (!is_valid())
-    return area_result_;
+    return area_result_ ? *area_result_ : SofaAreaResult{};
+  return is_compatible(qp_setup(), extra_ineqs);
+}
 
+SofaAreaResult SofaState::is_compatible(
+    const SofaQPSetup &setup,
+    const std::vector<LinearInequality> &extra_ineqs) const {
+  expect(is_valid());
   auto sol = sofa_area_qp(
-      ctx.area(e_), ctx, conds_, extra_ineqs);
+      setup.area, setup.nsd, ctx, setup.conds, extra_ineqs);
   return sol;
 }
 
+SofaQPSetup SofaState::qp_setup() const {
+  return {ctx.area(e_), ctx.area_nsd(e_), conds_.flat()};
+}
+
+SofaAreaResult SofaState::penalized_area(
+    const LinearForm &f, const QT &t) const {
+  return penalized_area(qp_setup(), f, t);
+}
+
+SofaAreaResult SofaState::penalized_area(
+    const SofaQPSetup &setup, const LinearForm &f, const QT &t) const {
+  expect(is_valid());
+  // Same quadratic part as the area, so the same proof of concavity
+  return sofa_area_qp(
+      setup.area - QuadraticForm(f) * t, setup.nsd, ctx, setup.conds);
+}
+
 Json::Value SofaState::json() const {
   Json::Value res(Json::objectValue);
   res["id"] = id_;
   res["niche"] = to_json(e());
-  res["constraints"] = to_json(conds_);
+  res["constraints"] = to_json(conds_.flat());
   // TODO: add proof that this e is valid from constraints
 
   // TODO: 'valid' here means that the max area is > 2.2195
@@ -182,25 +271,113 @@ Json::Value SofaState::json() const {
     res["valid"] = true;
   } else {
     res["valid"] = false;
-    res["invalidity_proof"] = area_result_.json();
+    // Not kept for loaded states
+    if (area_result_)
+      res["invalidity_proof"] = area_result_->json();
   }
 
   return res;
 }
 
+static size_t memory_usage(const QT &q) {
+  return sizeof(QT) + sizeof(mp_limb_t) * (
+      mpz_size(q.numerator().get_mpz_t()) +
+      mpz_size(q.denominator().get_mpz_t()));
+}
+
+// Map nodes hold a key, a value and about three pointers and a color
+template <typename K>
+static size_t memory_usage(const std::map<K, QT> &lambdas) {
+  size_t res = 0;
+  for (const auto &[k, v] : lambdas)
+    res += 4 * sizeof(void *) + sizeof(K) + memory_usage(v);
+  return res;
+}
+
+// Without the proof of concavity, which is shared by every state
+// with the same area form
+static size_t memory_usage(const SofaAreaResult &r) {
+  size_t res = sizeof(SofaAreaResult);
+  if (r.is_optimal()) {
+    const auto &p = r.optimality_proof();
+    res += memory_usage(p.max_area);
+    for (const auto &v : p.maximizer)
+      res += memory_usage(v);
+    res += memory_usage(p.lambdas) + memory_usage(p.lambdas_extra);
+  } else {
+    const auto &p = r.invalidity_proof();
+    res += memory_usage(p.lambdas) + memory_usage(p.lambdas_extra);
+  }
+  return res;
+}
+
+size_t SofaState::memory_usage() const {
+  size_t res = sizeof(SofaState);
+  res += e_.capacity() * sizeof(int);
+  res += conds_.size() * sizeof(SofaConstraintProbe);
+  res += ::memory_usage(area_);
+  for (const auto &v : vars_)
+    res += ::memory_usage(v);
+  // Split evenly between the states sharing it
+  if (area_result_)
+    res += ::memory_usage(*area_result_) / area_result_.use_count();
+  return res;
+}
+
+// `res` for the constraints `from`, with the lambdas moved to the
+// positions of the same constraints in `to`
+static std::shared_ptr<const SofaAreaResult> reindex(
+    const std::shared_ptr<const SofaAreaResult> &res,
+    const SofaConstraints &from,
+    const SofaConstraints &to) {
+  if (from == to)
+    return res;
+  std::map<SofaConstraintProbe, int> pos;
+  for (int i = int(to.size()) - 1; i >= 0; i--)
+    pos[to[i]] = i;
+  auto move = [&](const std::map<SofaConstraintProbe, QT> &lambdas) {
+    std::map<SofaConstraintProbe, QT> moved;
+    for (auto const &[i, lambda] : lambdas)
+      moved[pos.at(from[i])] = lambda;
+    return moved;
+  };
+  if (res->is_optimal()) {
+    auto proof = res->optimality_proof();
+    proof.lambdas = move(proof.lambdas);
+    return std::make_shared<const SofaAreaResult>(SofaAreaResult{proof});
+  } else {
+    auto proof = res->invalidity_proof();
+    proof.lambdas = move(proof.lambdas);
+    return std::make_shared<const SofaAreaResult>(SofaAreaResult{proof});
+  }
+}
+
 void SofaState::update_() {
   expect(!is_frozen_);
-  area_result_ = sofa_area_qp(ctx.area(e_), ctx, conds_);
-  if (area_result_) {
+  auto solve = [this](const SofaConstraints &conds) {
+    tree.num_qps_++;
+    return std::make_shared<const SofaAreaResult>(sofa_area_qp(
+        ctx.area(e_), ctx.area_nsd(e_), ctx, conds));
+  };
+  if (tree.qp_cache_) {
+    // Solved once per key, on the canonical constraints
+    auto k = key();
+    auto res = tree.qp_cache_->get(k, [&]() { return solve(k.conds); });
+    area_result_ = reindex(res, k.conds, conds_.flat());
+  } else {
+    area_result_ = solve(conds_.flat());
+  }
+  if (*area_result_) {
     is_valid_ = true;
-    area_ = area_result_.optimality_proof().max_area;
-    vars_ = area_result_.optimality_proof().maximizer;
+    is_area_certified_ = true;
+    area_ = area_result_->optimality_proof().max_area;
+    vars_ = area_result_->optimality_proof().maximizer;
     expect((ctx.area(e_))(vars_) == area_);
     expect(area_ > QT(22195, 10000));
   } else {
     is_valid_ = false;
     // state turned from valid to invalid
     std::lock_guard<std::mutex> guard(tree.lock_);
-    tree.invalid_states_.push_back(*this);
+    tree.record_invalid_(*this);
   }
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <initializer_list>
 #include <vector>
 
 #include <json/json.h>
@@ -9,11 +10,21 @@
 #include "ineq.h"
 #include "context.h"
 #include "qp.h"
+#include "constraints.h"
+#include "state_key.h"
 
 class CerealWriter;
 class CerealReader;
 class SofaBranchTree;
 
+// What the QPs of a state share: its area form, the proof that the form
+// is concave and the constraints. Computed once for many QPs on the state.
+struct SofaQPSetup {
+  QuadraticForm area;
+  std::shared_ptr<const CholeskyLDL> nsd;
+  SofaConstraints conds;
+};
+
 // Invariants: 
 // - Constraints are only added, never subtracted
 // - Updated area function (update_e) is monotonically smaller than
@@ -28,6 +39,8 @@ class SofaState {
     SofaState() = delete;
     // TODO: remove copy constructor
     SofaState(const SofaState &other);
+    // Leaves `other` with no niche or constraints; only destroy it after
+    SofaState(SofaState &&other) noexcept;
 
     // Prevent any assignment between states
     // No state is overwritten
@@ -40,7 +53,10 @@ class SofaState {
     std::string id_string() const;
     // Accessors to polyline constructs
     const std::vector<int> &e() const;
-    const std::vector<SofaConstraintProbe> &conds() const;
+    // Flat copy of the constraints
+    SofaConstraints conds() const;
+    // Canonical form of the niche and the constraints
+    SofaStateKey key() const;
     int e(int i) const;
     const LinearFormPoint &p(int i) const;
     Vector v(int i) const;
@@ -53,15 +69,34 @@ class SofaState {
     SofaState split(SofaConstraintProbe cond);
     // Update polyline
     void update_e(const std::vector<int> &e);
+    // Update polyline in place by replacing edges [first, last) with `edges`
+    void update_e(int first, int last, std::initializer_list<int> edges);
 
     // Guaranteed maximum area and maximizer
+    // Solved again only if the niche changed since the last solve
     QT area();
     std::vector<QT> vars();
+    // Certificate of `area()`
+    const SofaAreaOptimalityProof &area_proof();
+    // Last maximizer found and the area there, without solving again.
+    // Short of the maximum if the niche changed since the last solve.
+    const std::vector<QT> &last_vars() const;
+    const QT &last_area() const;
 
     SofaAreaResult is_compatible(
       const LinearInequality &extra_ineq) const;
     SofaAreaResult is_compatible(
       const std::vector<LinearInequality> &extra_ineqs) const;
+    SofaAreaResult is_compatible(
+      const SofaQPSetup &setup,
+      const std::vector<LinearInequality> &extra_ineqs) const;
+    SofaQPSetup qp_setup() const;
+    // Maximum of `area - t * f` over the state.
+    // For t > 0 the maximum H proves f >= (2.2195 - H) / t
+    // over the sofas of the state with area at least 2.2195.
+    SofaAreaResult penalized_area(const LinearForm &f, const QT &t) const;
+    SofaAreaResult penalized_area(
+      const SofaQPSetup &setup, const LinearForm &f, const QT &t) const;
 
     // Read/write
     // Does not store/load context information
@@ -70,6 +105,11 @@ class SofaState {
     friend CerealReader &operator>>(CerealReader &in, SofaBranchTree &v);
 
     Json::Value json() const;
+
+    // Approximate number of bytes held by the state.
+    // Shared constraints are counted in full, and a QP result shared with
+    // other states by its share.
+    size_t memory_usage() const;
     
   private:
     friend class SofaBranchTree;
@@ -81,12 +121,14 @@ class SofaState {
     // Read from a file
     explicit SofaState(SofaBranchTree &tree, const char *file);
     // Read from a stream
-    explicit SofaState(SofaBranchTree &tree, CerealReader &reader);
+    explicit SofaState(SofaBranchTree &tree, CerealReader &reader,
+                       bool frozen = true);
 
     int id_;
 
     std::vector<int> e_; 
-    SofaConstraints conds_;
+    // Shares its prefix with the parent state
+    SofaConstraintList conds_;
 
     // If a state node is 'frozen', user can't modify the contents of a node.
     // If the node is loaded from a file, the node gets frozen immediately.
@@ -95,10 +137,16 @@ class SofaState {
     // If state is invalid, contains a correct proof of invalidity
     // If valid, `area_result_` may not contain a correct proof of optimality
     // but `area_` and `vars_` always contain a valid assignment
-    SofaAreaResult area_result_;
+    // Shared between copies of the state
+    std::shared_ptr<const SofaAreaResult> area_result_;
     QT area_;
     std::vector<QT> vars_;
+    // Whether `area_` is the maximum area, and not only
+    // the area at `vars_` after `update_e`
+    bool is_area_certified_;
 
     // Called if and only if the state changes its value
     void update_();
+    // Called after `e_` changed to a smaller area function
+    void update_area_();
 };
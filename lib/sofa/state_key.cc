@@ -0,0 +1,36 @@
+#include "state_key.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+// FNV-1a over the niche, a separator and the constraints
+static size_t hash_ints(const std::vector<int> &e, const SofaConstraints &c) {
+  uint64_t h = 14695981039346656037ULL;
+  auto add = [&h](int v) {
+    auto u = uint32_t(v);
+    for (int k = 0; k < 4; k++) {
+      h ^= (u >> (8 * k)) & 0xff;
+      h *= 1099511628211ULL;
+    }
+  };
+  for (auto v : e)
+    add(v);
+  add(int(e.size()));
+  for (auto v : c)
+    add(v);
+  return size_t(h);
+}
+
+SofaStateKey::SofaStateKey(std::vector<int> e, SofaConstraints conds)
+    : e(std::move(e)), conds(std::move(conds)) {
+  std::sort(this->conds.begin(), this->conds.end());
+  this->conds.erase(
+      std::unique(this->conds.begin(), this->conds.end()),
+      this->conds.end());
+  hash = hash_ints(this->e, this->conds);
+}
+
+bool SofaStateKey::operator==(const SofaStateKey &other) const {
+  return hash == other.hash && e == other.e && conds == other.conds;
+}
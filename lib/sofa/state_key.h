@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "context.h"
+
+// Canonical form of a state: its niche and its constraints
+// sorted with duplicates removed.
+// States with the same key have the same area QP and the same subtree.
+struct SofaStateKey {
+  std::vector<int> e;
+  SofaConstraints conds;
+  size_t hash;
+
+  SofaStateKey(std::vector<int> e, SofaConstraints conds);
+
+  bool operator==(const SofaStateKey &other) const;
+};
+
+struct SofaStateKeyHash {
+  size_t operator()(const SofaStateKey &key) const {
+    return key.hash;
+  }
+};
+
+// Map from state keys to values, safe to use from multiple threads.
+// Locks one of a fixed number of shards per access.
+template <typename V>
+class SofaStateTable {
+  public:
+    // Value of `key`, computed by `compute()` if missing.
+    // `compute` runs without a lock, so it may run twice for a key
+    // and only the first result is kept.
+    V get(const SofaStateKey &key, const std::function<V()> &compute) {
+      auto &shard = shards_[key.hash % num_shards];
+      {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        auto it = shard.map.find(key);
+        if (it != shard.map.end())
+          return it->second;
+      }
+      V v = compute();
+      std::lock_guard<std::mutex> guard(shard.lock);
+      return shard.map.emplace(key, std::move(v)).first->second;
+    }
+
+    // Number of keys, counted without stopping other threads
+    size_t size() {
+      size_t res = 0;
+      for (auto &shard : shards_) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        res += shard.map.size();
+      }
+      return res;
+    }
+
+    void clear() {
+      for (auto &shard : shards_) {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        shard.map.clear();
+      }
+    }
+
+  private:
+    static constexpr size_t num_shards = 64;
+    struct Shard {
+      std::mutex lock;
+      std::unordered_map<SofaStateKey, V, SofaStateKeyHash> map;
+    };
+    std::array<Shard, num_shards> shards_;
+};
@@ -0,0 +1,240 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "expect.h"
+
+static thread_local int current_worker_id = -1;
+
+// CPUs in a list such as "0-3,8-11"
+static std::vector<int> parse_cpu_list(const std::string &list) {
+  std::vector<int> res;
+  std::stringstream sin(list);
+  std::string range;
+  while (std::getline(sin, range, ',')) {
+    if (range.empty())
+      continue;
+    auto dash = range.find('-');
+    int lo = std::stoi(range.substr(0, dash));
+    int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+    for (int cpu = lo; cpu <= hi; cpu++)
+      res.push_back(cpu);
+  }
+  return res;
+}
+
+// CPUs of each NUMA node with any, or every CPU as a single node
+static std::vector< std::vector<int> > numa_nodes() {
+  std::map< int, std::vector<int> > nodes;
+  std::error_code ec;
+  std::filesystem::directory_iterator it("/sys/devices/system/node", ec);
+  for (; !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+    auto name = it->path().filename().string();
+    if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+        !std::all_of(name.begin() + 4, name.end(), ::isdigit))
+      continue;
+    std::ifstream in(it->path() / "cpulist");
+    std::string list;
+    std::getline(in, list);
+    auto cpus = parse_cpu_list(list);
+    // Nodes with memory only
+    if (!cpus.empty())
+      nodes[std::stoi(name.substr(4))] = cpus;
+  }
+
+  std::vector< std::vector<int> > res;
+  for (auto &node : nodes)
+    res.push_back(node.second);
+  if (res.empty()) {
+    res.emplace_back();
+    int n = std::max(1u, std::thread::hardware_concurrency());
+    for (int cpu = 0; cpu < n; cpu++)
+      res.back().push_back(cpu);
+  }
+  return res;
+}
+
+ThreadPool::ThreadPool(int nthread, bool pin)
+    : pin_(pin), next_node_(0), stop_(false) {
+  expect(nthread > 0);
+  if (pin) {
+    // Consecutive workers fill one node after another
+    auto nodes = numa_nodes();
+    int num_nodes = int(std::min(nodes.size(), size_t(nthread)));
+    for (int id = 0; id < nthread; id++) {
+      int node = int(size_t(id) * num_nodes / nthread);
+      int first = int((size_t(node) * nthread + num_nodes - 1) / num_nodes);
+      const auto &cpus = nodes[node];
+      node_of_.push_back(node);
+      cpu_of_.push_back(cpus[(id - first) % cpus.size()]);
+    }
+  } else {
+    node_of_.assign(nthread, 0);
+    cpu_of_.assign(nthread, -1);
+  }
+  int num_nodes = node_of_.back() + 1;
+  queues_.resize(num_nodes);
+  cvs_ = std::vector<std::condition_variable>(num_nodes);
+  idle_.assign(num_nodes, 0);
+  for (int id = 0; id < nthread; id++)
+    workers_.emplace_back(&ThreadPool::work_, this, id);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stop_ = true;
+  }
+  for (auto &cv : cvs_)
+    cv.notify_all();
+  for (auto &w : workers_)
+    w.join();
+}
+
+int ThreadPool::size() const {
+  return int(workers_.size());
+}
+
+int ThreadPool::worker_id() {
+  return current_worker_id;
+}
+
+bool ThreadPool::is_pinned() const {
+  return pin_;
+}
+
+int ThreadPool::num_nodes() const {
+  return int(queues_.size());
+}
+
+int ThreadPool::node_of(int worker) const {
+  return node_of_[worker];
+}
+
+int ThreadPool::submit_node_() {
+  int id = worker_id();
+  if (id >= 0 && id < size() &&
+      std::this_thread::get_id() == workers_[id].get_id())
+    return node_of_[id];
+  std::lock_guard<std::mutex> guard(lock_);
+  int node = next_node_;
+  next_node_ = (next_node_ + 1) % num_nodes();
+  return node;
+}
+
+void ThreadPool::enqueue_(std::function<void()> task, int node) {
+  std::lock_guard<std::mutex> guard(lock_);
+  queues_[node].push_back(std::move(task));
+  if (idle_[node] > 0) {
+    cvs_[node].notify_one();
+    return;
+  }
+  // Every worker of the node is busy, so let another node steal it
+  for (int other = 0; other < num_nodes(); other++) {
+    if (idle_[other] > 0) {
+      cvs_[other].notify_one();
+      return;
+    }
+  }
+}
+
+void ThreadPool::work_(int id) {
+  current_worker_id = id;
+  int node = node_of_[id];
+#ifdef __linux__
+  if (cpu_of_[id] >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu_of_[id], &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+#endif
+
+  std::unique_lock<std::mutex> guard(lock_);
+  while (true) {
+    // Own node first, then the others in order
+    int from = -1;
+    for (int k = 0; k < num_nodes() && from < 0; k++) {
+      int other = (node + k) % num_nodes();
+      if (!queues_[other].empty())
+        from = other;
+    }
+    if (from < 0) {
+      if (stop_)
+        return;
+      idle_[node]++;
+      cvs_[node].wait(guard);
+      idle_[node]--;
+      continue;
+    }
+    auto task = std::move(queues_[from].front());
+    queues_[from].pop_front();
+    guard.unlock();
+    task();
+    guard.lock();
+  }
+}
+
+void ThreadPool::run(int n, const std::function<void(int)> &f) {
+  if (worker_id() >= 0 || n == 1) {
+    // Already on a worker: waiting here could leave no worker to run f
+    for (int rnk = 0; rnk < n; rnk++)
+      f(rnk);
+    return;
+  }
+  std::vector< std::future<void> > jobs;
+  for (int rnk = 0; rnk < n; rnk++)
+    jobs.push_back(submit_to_(
+        [&f, rnk]() { f(rnk); }, node_of_[rnk % size()]));
+  // Wait for every job before rethrowing, as they refer to `f`
+  std::exception_ptr error;
+  for (auto &job : jobs) {
+    try {
+      job.get();
+    } catch (...) {
+      if (!error)
+        error = std::current_exception();
+    }
+  }
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void ThreadPool::parallel_for(
+    size_t n, const std::function<void(size_t)> &f) {
+  int parts = int(std::min(n, size_t(size())));
+  run(parts, [&](int rnk) {
+    for (size_t i = rnk; i < n; i += parts)
+      f(i);
+  });
+}
+
+static std::unique_ptr<ThreadPool> shared_pool;
+static std::mutex shared_pool_lock;
+
+ThreadPool &thread_pool() {
+  std::lock_guard<std::mutex> guard(shared_pool_lock);
+  if (!shared_pool)
+    shared_pool = std::make_unique<ThreadPool>(
+        std::max(1u, std::thread::hardware_concurrency()));
+  return *shared_pool;
+}
+
+void set_num_threads(int nthread, bool pin) {
+  std::lock_guard<std::mutex> guard(shared_pool_lock);
+  // The old workers finish before the new ones start
+  shared_pool.reset();
+  shared_pool = std::make_unique<ThreadPool>(nthread, pin);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Fixed set of worker threads running submitted tasks in order.
+// A task waiting for other tasks of the same pool is run inline instead,
+// so that nested parallel calls can't exhaust the workers.
+// Workers are grouped by NUMA node, and each node has its own queue.
+// A worker takes tasks from the queue of its node first,
+// and only steals from the other nodes when it is empty.
+class ThreadPool {
+  public:
+    // If `pin`, consecutive workers are pinned to the cores of one node
+    // after another (Linux only), so that the memory they touch first
+    // stays on their node. Otherwise there is a single node.
+    explicit ThreadPool(int nthread, bool pin = false);
+    // Finishes the queued tasks first
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &other) = delete;
+    ThreadPool &operator=(const ThreadPool &other) = delete;
+
+    int size() const;
+
+    // Runs `f()` on a worker.
+    // The future holds its result, or the exception it threw.
+    template <typename F>
+    std::future< std::invoke_result_t<F> > submit(F f) {
+      return submit_to_(std::move(f), submit_node_());
+    }
+
+    // Calls `f(rnk)` for every `rnk` in [0, n) and waits for all of them.
+    // Each call is one task, so `n` is the number of parts of the work.
+    // Part `rnk` is queued on the node of worker `rnk % size()`.
+    // Rethrows the first exception thrown.
+    void run(int n, const std::function<void(int)> &f);
+
+    // Calls `f(i)` for every `i` in [0, n) over all workers and waits
+    void parallel_for(size_t n, const std::function<void(size_t)> &f);
+
+    // Combines `map(i)` for every `i` in [0, n) with `combine`,
+    // starting from `init`. `combine` must be associative and commutative.
+    template <typename T, typename Map, typename Combine>
+    T reduce(size_t n, T init, Map map, Combine combine) {
+      int parts = size();
+      std::vector<T> partial(parts, init);
+      run(parts, [&](int rnk) {
+        for (size_t i = rnk; i < n; i += parts)
+          partial[rnk] = combine(std::move(partial[rnk]), map(i));
+      });
+      T res = std::move(init);
+      for (auto &p : partial)
+        res = combine(std::move(res), std::move(p));
+      return res;
+    }
+
+    // Index of the calling worker of any pool in [0, size()),
+    // or -1 outside of a pool
+    static int worker_id();
+
+    bool is_pinned() const;
+    int num_nodes() const;
+    int node_of(int worker) const;
+
+  private:
+    bool pin_;
+    std::vector<std::thread> workers_;
+    // Node and core of each worker, or -1 for no core
+    std::vector<int> node_of_;
+    std::vector<int> cpu_of_;
+    std::mutex lock_;
+    // Per node
+    std::vector< std::deque< std::function<void()> > > queues_;
+    std::vector<std::condition_variable> cvs_;
+    std::vector<int> idle_;
+    int next_node_;
+    bool stop_;
+
+    // Node of the calling worker, or the next node in turn
+    int submit_node_();
+    template <typename F>
+    std::future< std::invoke_result_t<F> > submit_to_(F f, int node) {
+      using R = std::invoke_result_t<F>;
+      auto task = std::make_shared< std::packaged_task<R()> >(std::move(f));
+      auto res = task->get_future();
+      enqueue_([task]() { (*task)(); }, node);
+      return res;
+    }
+    void enqueue_(std::function<void()> task, int node);
+    void work_(int id);
+};
+
+// Pool shared by the library, with `std::thread::hardware_concurrency()`
+// workers unless set otherwise
+ThreadPool &thread_pool();
+// Replaces the shared pool with one of `nthread` workers,
+// pinned to cores if `pin`. Only call while no task runs.
+void set_num_threads(int nthread, bool pin = false);
+
+// Object of type T private to the calling thread, for temporaries
+// (such as GMP numbers) that should keep their memory between calls.
+// Callers must not hold on to it across calls that may use it too.
+template <typename T>
+T &thread_scratch() {
+  thread_local T scratch;
+  return scratch;
+}
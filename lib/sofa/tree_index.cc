@@ -0,0 +1,114 @@
+#include "tree_index.h"
+
+#include <filesystem>
+
+#include "bound.h"
+#include "cereal.h"
+#include "thread_pool.h"
+#include "expect.h"
+
+// Marks an index after a tree, so that a tree without one reads as such
+static const size_t index_magic = 0x78646e4961666f73;
+
+TreeIndex::TreeIndex() {}
+
+TreeIndex TreeIndex::build(
+    const SofaBranchTree &tree,
+    const std::vector<LinearForm> &directions,
+    const QT &tol, int max_qps) {
+  const auto &nodes = tree.valid_states();
+  int d = tree.ctx.d();
+  TreeIndex res;
+  for (const auto &f : directions)
+    res.directions_.push_back(direction(f).first);
+  res.var_min_.resize(nodes.size());
+  res.var_max_.resize(nodes.size());
+  res.dir_min_.resize(nodes.size());
+
+  thread_pool().parallel_for(nodes.size(), [&](size_t i) {
+    const auto &v = nodes[i];
+    auto setup = v.qp_setup();
+    for (int j = 0; j < d; j++) {
+      auto x = LinearForm::variable(d, j);
+      res.var_min_[i].push_back(
+          min_over_state(v, setup, x, tol, max_qps).lower);
+      res.var_max_[i].push_back(
+          -min_over_state(v, setup, -x, tol, max_qps).lower);
+    }
+    for (const auto &f : res.directions_)
+      res.dir_min_[i].push_back(
+          min_over_state(v, setup, f, tol, max_qps).lower);
+  });
+  return res;
+}
+
+size_t TreeIndex::num_leaves() const {
+  return var_min_.size();
+}
+
+const std::vector<LinearForm> &TreeIndex::directions() const {
+  return directions_;
+}
+
+QT TreeIndex::lower(size_t leaf, const LinearForm &f) const {
+  expect(leaf < num_leaves());
+  const auto &lo = var_min_[leaf], &hi = var_max_[leaf];
+  expect(int(lo.size()) == f.d());
+  QT res = f.w0();
+  for (int j = 0; j < f.d(); j++) {
+    const auto &w = f.w1(j);
+    if (w > 0)
+      res += w * lo[j];
+    else if (w < 0)
+      res += w * hi[j];
+  }
+
+  if (directions_.empty())
+    return res;
+  auto [dir, c] = direction(f);
+  for (size_t k = 0; k < directions_.size(); k++) {
+    if (c > 0 && dir == directions_[k]) {
+      QT b = f.w0() + c * dir_min_[leaf][k];
+      if (b > res)
+        res = b;
+    }
+  }
+  return res;
+}
+
+CerealWriter &operator<<(CerealWriter &out, const TreeIndex &v) {
+  out << index_magic << v.directions_;
+  out << v.var_min_ << v.var_max_ << v.dir_min_;
+  return out;
+}
+
+CerealReader &operator>>(CerealReader &in, TreeIndex &v) {
+  size_t magic;
+  in >> magic;
+  expect(magic == index_magic);
+  in >> v.directions_;
+  in >> v.var_min_ >> v.var_max_ >> v.dir_min_;
+  return in;
+}
+
+void write_index(const char *path, size_t tree_end, const TreeIndex &index) {
+  std::filesystem::resize_file(path, tree_end);
+  CerealWriter writer(path, true);
+  writer << index;
+  writer.close();
+}
+
+std::optional<TreeIndex> read_index(CerealReader &in) {
+  auto pos = in.tellg();
+  size_t magic;
+  in >> magic;
+  if (!in || magic != index_magic) {
+    in.clear();
+    in.seekg(pos);
+    return std::nullopt;
+  }
+  in.seekg(pos);
+  TreeIndex res;
+  in >> res;
+  return res;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "number.h"
+#include "forms.h"
+#include "branch_tree.h"
+
+class CerealReader;
+class CerealWriter;
+
+// Proven bounds of the variables and a few chosen directions over the
+// sofas of each valid leaf with area at least 2.2195.
+// Bounds a linear form over a leaf by interval arithmetic without a QP.
+class TreeIndex {
+  public:
+    TreeIndex();
+
+    // Bounds each variable and each of `directions` over each valid leaf
+    // of `tree` by `min_over_state` to within `tol`
+    static TreeIndex build(
+        const SofaBranchTree &tree,
+        const std::vector<LinearForm> &directions,
+        const QT &tol, int max_qps);
+
+    size_t num_leaves() const;
+    const std::vector<LinearForm> &directions() const;
+
+    // Lower bound of `f` over the `leaf`-th valid leaf
+    QT lower(size_t leaf, const LinearForm &f) const;
+
+    friend CerealWriter &operator<<(CerealWriter &out, const TreeIndex &v);
+    friend CerealReader &operator>>(CerealReader &in, TreeIndex &v);
+
+  private:
+    // Directions up to a positive multiple and without constant term
+    std::vector<LinearForm> directions_;
+    // Lower and upper bounds of the variables of each leaf,
+    // and lower bounds of the directions
+    std::vector< std::vector<QT> > var_min_, var_max_, dir_min_;
+};
+
+// Writes `index` after the tree in the file `path`, replacing any index
+// there. `tree_end` is the position where the tree ends in the file.
+void write_index(const char *path, size_t tree_end, const TreeIndex &index);
+// Index after the tree in `in`, read up to the end of the tree, if any
+std::optional<TreeIndex> read_index(CerealReader &in);
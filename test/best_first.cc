@@ -0,0 +1,37 @@
+#include <catch2/catch_all.hpp>
+
+#include "sofa/number.h"
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+
+#include "fixtures.h"
+
+TEST_CASE( "Best-first search matches full branching", "[SEARCH]" ) {
+  SofaContext ctx(small_angles());
+
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  t.add_corner(4);
+
+  SofaBranchTree t2(ctx);
+  REQUIRE( t2.max_area_best_first({{3, true}, {4, true}}) ==
+           max_leaf_area(t) );
+}
+
+TEST_CASE( "Parallel max area matches the leaves", "[SEARCH]" ) {
+  SofaContext ctx(small_angles());
+
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  t.add_corner(4);
+  auto best = t.max_area();
+  long long num_qps = t.num_qps();
+
+  QT marea = max_leaf_area(t);
+  REQUIRE( best.area == marea );
+  REQUIRE( best.proof );
+  REQUIRE( best.proof->max_area == marea );
+  // Areas are certified once, then reused
+  REQUIRE( t.num_qps() == num_qps );
+  REQUIRE( t.max_area().id == best.id );
+}
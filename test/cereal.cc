@@ -2,12 +2,16 @@
 #include <catch2/catch_all.hpp>
 
 #include <iostream>
+#include <set>
 #include <unistd.h>
 
 #include "sofa/context.h"
 #include "sofa/cereal.h"
 #include "sofa/qp.h"
 #include "sofa/geom.h"
+#include "sofa/json.h"
+
+#include "fixtures.h"
 
 void debug_states(std::vector<SofaState> valid_states) {
   
@@ -128,14 +132,7 @@ TEST_CASE( "Checking exactness of cereal read/write", "[CEREAL]" ) {
     REQUIRE(v == q);
   }
   {
-    SofaContext ctx({
-        {QT{1911,1961},QT{440,1961}},
-        {QT{85608,95017},QT{41225,95017}},
-        {QT{351,449},QT{280,449}},
-        {QT{280,449},QT{351,449}},
-        {QT{41225,95017},QT{85608,95017}},
-        {QT{440,1961},QT{1911,1961}}
-        });
+    SofaContext ctx(small_angles());
     SofaBranchTree t(ctx);
     t.add_corner(3);
     t.add_corner(4);
@@ -155,6 +152,111 @@ TEST_CASE( "Checking exactness of cereal read/write", "[CEREAL]" ) {
     }
     // TODO: check if they give the same result
   }
+  {
+    SofaContext ctx(small_angles());
+    SofaBranchTree t(ctx);
+    t.add_corner(3);
+    save("prefix.crl", t);
+    t.add_corner(4);
+
+    // continue branching from the saved prefix
+    CerealReader reader("prefix.crl");
+    SofaBranchTree t2(ctx, reader, false);
+    reader.close();
+    t2.add_corner(4);
+    auto l = t.valid_states();
+    auto l2 = t2.valid_states();
+    REQUIRE( l.size() == l2.size() );
+    for (size_t i = 0; i < l.size(); i++) {
+      REQUIRE( l[i].e() == l2[i].e() );
+      REQUIRE( l[i].conds() == l2[i].conds() );
+    }
+
+    // merged leaves get distinct IDs
+    t2.merge(t);
+    std::set<int> ids;
+    for (const auto &s : t2.valid_states())
+      ids.insert(s.id());
+    REQUIRE( ids.size() == 2 * l.size() );
+  }
+  {
+    SofaContext ctx(small_angles());
+    SofaBranchTree t(ctx);
+    t.record_to("journal.crl");
+    t.add_corner(3);
+    t.add_corner(4);
+
+    // every split node has two children, each either split or leaf
+    auto splits = t.split_nodes();
+    auto leaves = t.leaf_nodes();
+    REQUIRE( leaves.size() == splits.size() + 1 );
+    REQUIRE( leaves.size() >= t.valid_states().size() );
+    for (const auto &name : splits.getMemberNames()) {
+      for (auto child : {"left", "right"}) {
+        auto c = splits[name][child].asString();
+        REQUIRE( splits.isMember(c) != leaves.isMember(c) );
+      }
+    }
+  }
+  {
+    SofaContext ctx(small_angles());
+    SofaBranchTree t(ctx);
+    t.record_to("journal-area.crl");
+
+    // states dying by a maximum area of at most 2.2195 keep its proof
+    auto died_by_area = [&t]() {
+      auto leaves = t.leaf_nodes();
+      for (const auto &name : leaves.getMemberNames()) {
+        const auto &leaf = leaves[name];
+        if (!leaf["valid"].asBool() &&
+            leaf["invalidity_proof"]["type"].asString() == "optimal") {
+          REQUIRE( qt_from_json(leaf["invalidity_proof"]["max_area"]) <=
+                   QT(22195, 10000) );
+          return true;
+        }
+      }
+      return false;
+    };
+    bool found = false;
+    for (int i : {3, 4, 2, 5, 1, 6}) {
+      t.add_corner(i);
+      found = died_by_area();
+      if (found)
+        break;
+    }
+    REQUIRE( found );
+  }
+  {
+    SofaContext ctx(small_angles());
+    SofaBranchTree t(ctx);
+    t.add_corner(3);
+    t.add_corner(4);
+    t.add_corner(2);
+
+    // spill after every state
+    SofaBranchTree t2(ctx);
+    t2.memory_budget(1, "spill");
+    t2.add_corner(3);
+    t2.add_corner(4);
+    t2.add_corner(2);
+    REQUIRE( t2.num_states() == t.valid_states().size() );
+    REQUIRE( t2.valid_states().size() < t2.num_states() );
+
+    // spilled states are streamed to the file
+    save("spilled.crl", t2);
+    CerealReader reader("spilled.crl");
+    SofaBranchTree t3(ctx, reader);
+    reader.close();
+    REQUIRE( t3.valid_states().size() == t2.num_states() );
+
+    t2.gather();
+    std::set< std::pair< std::vector<int>, SofaConstraints > > l, l2;
+    for (const auto &s : t.valid_states())
+      l.insert({s.e(), s.conds()});
+    for (const auto &s : t2.valid_states())
+      l2.insert({s.e(), s.conds()});
+    REQUIRE( l == l2 );
+  }
   /*
   BENCHMARK("qform store and write") {
     QuadraticForm a(ctx.area({0, 1, 2, 5, -3, 4, -4, 3, -5, -2, -1, 0})); 
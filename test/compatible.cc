@@ -1,11 +1,17 @@
 #define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch_all.hpp>
 
+#include <filesystem>
 #include <iostream>
 
 #include "sofa/context.h"
 #include "sofa/branch_tree.h"
 #include "sofa/qp.h"
+#include "sofa/bound.h"
+#include "sofa/cereal.h"
+#include "sofa/tree_index.h"
+
+#include "fixtures.h"
 
 TEST_CASE( "Checking compatibility", "[CMP]" ) {
   SofaContext ctx( {
@@ -39,3 +45,93 @@ TEST_CASE( "Checking compatibility", "[CMP]" ) {
   };
   */
 }
+
+TEST_CASE( "Lagrangian bounds of a leaf", "[CMP]" ) {
+  SofaContext ctx(small_angles());
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  const auto &s = t.valid_states()[0];
+
+  auto val = ctx.s(ctx.n());
+  auto b = min_over_state(s, val, QT(1, 1000), 20);
+  REQUIRE( b.num_qps <= 20 );
+  REQUIRE( b.proof.max_area == 
+           (ctx.area(s.e()) - QuadraticForm(val) * b.t)(b.proof.maximizer) );
+  // no sofa of the leaf is below the bound
+  REQUIRE( !s.is_compatible(val <= b.lower - QT(1, 1000000)) );
+  if (b.witness)
+    REQUIRE( b.lower <= *b.witness );
+}
+
+TEST_CASE( "QPs on a shared setup match those without", "[CMP]" ) {
+  SofaContext ctx(small_angles());
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  t.add_corner(4);
+
+  auto val = ctx.s(ctx.n());
+  for (const auto &s : t.valid_states()) {
+    auto setup = s.qp_setup();
+    for (const QT &c : {QT(1), QT(3, 2), QT(2)}) {
+      REQUIRE( bool(s.is_compatible(setup, {val <= c})) ==
+               bool(s.is_compatible({val <= c})) );
+      REQUIRE( bool(s.is_compatible(setup, {val >= c, val <= c * 2})) ==
+               bool(s.is_compatible({val >= c, val <= c * 2})) );
+    }
+    auto a = s.penalized_area(setup, val, QT(1, 2));
+    auto b = s.penalized_area(val, QT(1, 2));
+    REQUIRE( a.is_optimal() == b.is_optimal() );
+    if (a.is_optimal())
+      REQUIRE( a.optimality_proof().max_area ==
+               b.optimality_proof().max_area );
+
+    auto sa = min_over_state(s, setup, val, QT(1, 1000), 10);
+    auto sb = min_over_state(s, val, QT(1, 1000), 10);
+    REQUIRE( sa.lower == sb.lower );
+    REQUIRE( sa.t == sb.t );
+    REQUIRE( sa.num_qps == sb.num_qps );
+    REQUIRE( sa.witness == sb.witness );
+  }
+}
+
+TEST_CASE( "Interval bounds from a tree index", "[CMP]" ) {
+  SofaContext ctx(small_angles());
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  const auto &s = t.valid_states()[0];
+
+  auto val = ctx.s(ctx.n());
+  auto other = ctx.s(1) - ctx.s(2) * QT(3);
+  auto index = TreeIndex::build(t, {other * QT(2)}, QT(1, 1000), 20);
+  REQUIRE( index.num_leaves() == t.valid_states().size() );
+  // no sofa of the leaf is below the bounds
+  for (const auto &f : {val, other, -val}) {
+    QT lower = index.lower(0, f);
+    REQUIRE( !s.is_compatible(f <= lower - QT(1, 1000000)) );
+  }
+  // a direction is bounded at least as tight as the box
+  auto boxes = TreeIndex::build(t, {}, QT(1, 1000), 20);
+  auto shifted = other + LinearForm::constant(ctx.d(), 1);
+  REQUIRE( index.lower(0, shifted) >= boxes.lower(0, shifted) );
+  REQUIRE( index.lower(0, shifted) == index.lower(0, other) + QT(1) );
+
+  {
+    CerealWriter w("indexed.crl");
+    w << ctx << t;
+    w.close();
+  }
+  size_t tree_end = std::filesystem::file_size("indexed.crl");
+  write_index("indexed.crl", tree_end, index);
+  // a second index replaces the first
+  write_index("indexed.crl", tree_end, index);
+
+  CerealReader r("indexed.crl");
+  SofaContext rctx(r);
+  SofaBranchTree rt(rctx, r);
+  auto read = read_index(r);
+  r.close();
+  REQUIRE( read );
+  REQUIRE( read->directions() == index.directions() );
+  REQUIRE( read->lower(0, other) == index.lower(0, other) );
+  REQUIRE( std::filesystem::file_size("indexed.crl") > tree_end );
+}
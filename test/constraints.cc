@@ -0,0 +1,28 @@
+#include <catch2/catch_all.hpp>
+
+#include "sofa/constraints.h"
+
+TEST_CASE( "Persistent constraint lists", "[CONSTRAINTS]" ) {
+  SofaConstraintList a({1, 2, 3});
+  a.push_back(4);
+  REQUIRE( a.size() == 4 );
+  REQUIRE( a.flat() == SofaConstraints{1, 2, 3, 4} );
+
+  a.share();
+  SofaConstraintList b(a);
+  a.push_back(5);
+  b.push_back(-5);
+  REQUIRE( a.flat() == SofaConstraints{1, 2, 3, 4, 5} );
+  REQUIRE( b.flat() == SofaConstraints{1, 2, 3, 4, -5} );
+  REQUIRE( a != b );
+
+  // copies without `share` keep their own tail
+  SofaConstraintList c(b);
+  c.push_back(6);
+  REQUIRE( b.size() == 5 );
+  REQUIRE( c.flat() == SofaConstraints{1, 2, 3, 4, -5, 6} );
+
+  SofaConstraintList d({1, 2, 3, 4, -5});
+  REQUIRE( d == b );
+  REQUIRE( SofaConstraintList().flat().empty() );
+}
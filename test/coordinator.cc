@@ -0,0 +1,46 @@
+#include <catch2/catch_all.hpp>
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+#include "sofa/coordinator.h"
+
+#include "fixtures.h"
+
+TEST_CASE( "Worker processes match serial branching", "[SEARCH]" ) {
+  SofaContext ctx(small_angles());
+
+  SofaBranchTree serial(ctx);
+  serial.add_corner(3);
+  serial.add_corner(4);
+  serial.add_corner(2);
+
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  add_corners_with_workers(t, {{4, true}, {2, true}}, 2, 1, "workers");
+  REQUIRE( leaves(t) == leaves(serial) );
+
+  // IDs stay unique after merging the results of the workers
+  std::vector<int> ids;
+  for (const auto &s : t.valid_states())
+    ids.push_back(s.id());
+  std::sort(ids.begin(), ids.end());
+  REQUIRE( std::unique(ids.begin(), ids.end()) == ids.end() );
+  std::filesystem::remove_all("workers");
+}
+
+TEST_CASE( "Worker processes give up on a failing task", "[SEARCH]" ) {
+  SofaContext ctx(small_angles());
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  // Corner out of range, so every worker dies on every task.
+  // Each death queues the task again until it failed 3 times.
+  REQUIRE_THROWS_AS(
+      add_corners_with_workers(t, {{ctx.n() + 1, false}}, 2, 1, "failing"),
+      std::runtime_error );
+  std::filesystem::remove_all("failing");
+}
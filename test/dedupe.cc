@@ -0,0 +1,43 @@
+#include <catch2/catch_all.hpp>
+
+#include <set>
+#include <tuple>
+
+#include "sofa/number.h"
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+#include "sofa/state_key.h"
+
+#include "fixtures.h"
+
+TEST_CASE( "State keys ignore the order of constraints", "[DEDUPE]" ) {
+  SofaStateKey a({0, 1, 0}, {3, 1, 2, 1});
+  SofaStateKey b({0, 1, 0}, {1, 2, 3});
+  SofaStateKey c({0, 2, 0}, {1, 2, 3});
+  REQUIRE( a == b );
+  REQUIRE( a.hash == b.hash );
+  REQUIRE( !(a == c) );
+}
+
+TEST_CASE( "Deduplicated branching keeps the maximum area", "[DEDUPE]" ) {
+  SofaContext ctx(small_angles());
+
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  t.add_corner(4);
+
+  SofaBranchTree t2(ctx);
+  t2.dedupe(true);
+  t2.add_corner(3);
+  t2.add_corner(4);
+
+  REQUIRE( t2.valid_states().size() <= t.valid_states().size() );
+  REQUIRE( max_leaf_area(t2) == max_leaf_area(t) );
+
+  std::set<SofaStateKey, bool(*)(const SofaStateKey &, const SofaStateKey &)>
+    keys([](const SofaStateKey &a, const SofaStateKey &b) {
+      return std::tie(a.e, a.conds) < std::tie(b.e, b.conds);
+    });
+  for (const auto &s : t2.valid_states())
+    REQUIRE( keys.insert(s.key()).second );
+}
@@ -0,0 +1,23 @@
+#include <catch2/catch_all.hpp>
+
+#include "sofa/number.h"
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+#include "sofa/estimate.h"
+
+#include "fixtures.h"
+
+TEST_CASE( "Estimate of the first layer is exact", "[ESTIMATE]" ) {
+  SofaContext ctx(small_angles());
+
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+
+  SofaBranchTree t2(ctx);
+  auto est = estimate_tree(t2, {{3, true}, {4, true}}, 10);
+  REQUIRE( est.size() == 2 );
+  REQUIRE( est[0].corner == 3 );
+  REQUIRE( est[0].states.mean == double(t.valid_states().size()) );
+  REQUIRE( est[0].states.err == 0 );
+  REQUIRE( est[1].states.mean >= 0 );
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "sofa/number.h"
+#include "sofa/geom.h"
+#include "sofa/branch_tree.h"
+
+// Six angles symmetric under swapping cos and sin,
+// small enough to branch fully in a test
+inline std::vector<Vector> small_angles() {
+  return {
+      {QT{1911,1961},QT{440,1961}},
+      {QT{85608,95017},QT{41225,95017}},
+      {QT{351,449},QT{280,449}},
+      {QT{280,449},QT{351,449}},
+      {QT{41225,95017},QT{85608,95017}},
+      {QT{440,1961},QT{1911,1961}}
+      };
+}
+
+// Largest maximum area over the leaves, solved one leaf at a time
+inline QT max_leaf_area(const SofaBranchTree &t) {
+  QT res(0);
+  auto x(t.valid_states());
+  for (auto &s : x)
+    res = std::max(res, s.area());
+  return res;
+}
+
+// Niches and constraints of the leaves, in an order not depending on IDs
+inline std::vector< std::pair< std::vector<int>, SofaConstraints > > leaves(
+    const SofaBranchTree &t) {
+  std::vector< std::pair< std::vector<int>, SofaConstraints > > res;
+  for (const auto &s : t.valid_states())
+    res.emplace_back(s.e(), s.conds());
+  std::sort(res.begin(), res.end());
+  return res;
+}
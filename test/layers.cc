@@ -0,0 +1,92 @@
+#include <catch2/catch_all.hpp>
+
+#include <filesystem>
+#include <utility>
+#include <vector>
+
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+#include "sofa/cereal.h"
+#include "sofa/json.h"
+#include "sofa/layers.h"
+
+#include "fixtures.h"
+
+// Angles of `small_angles()` with the branch order of each, -1 to skip
+static Json::Value angles_json(const std::vector<int> &order) {
+  Json::Value res(Json::arrayValue);
+  auto angles = small_angles();
+  for (size_t i = 0; i < angles.size(); i++) {
+    Json::Value angle(Json::objectValue);
+    angle["cos"] = to_json(angles[i].x);
+    angle["sin"] = to_json(angles[i].y);
+    angle["branch_order"] = order[i];
+    res.append(angle);
+  }
+  return res;
+}
+
+TEST_CASE( "Restarting from checkpointed layers", "[CEREAL]" ) {
+  std::string out = "layered.crl";
+  std::filesystem::remove_all(layers_path(out));
+  Json::Value options(Json::objectValue);
+  options["dedupe"] = false;
+
+  // Corners 3, 4, 2 and 3, 4, 5
+  auto first = angles_json({-1, 2, 0, 1, -1, -1});
+  auto second = angles_json({-1, -1, 0, 1, 2, -1});
+  REQUIRE( branch_corners(first) ==
+           std::vector< std::pair<int, bool> >{{3, false}, {4, false}, {2, false}} );
+
+  SofaContext ctx(first);
+  SofaBranchTree t(ctx);
+  start_layers(out, "", first, options, 0);
+  size_t k = 0;
+  for (const auto &corner : branch_corners(first)) {
+    t.add_corner(corner.first, corner.second);
+    write_layer(out, ++k, t);
+  }
+
+  REQUIRE( reusable_prefix(out, first, options) == 3 );
+  REQUIRE( reusable_prefix(out, second, options) == 2 );
+  Json::Value other_options(options);
+  other_options["dedupe"] = true;
+  REQUIRE( reusable_prefix(out, second, other_options) == 0 );
+  REQUIRE( reusable_prefix("missing.crl", first, options) == 0 );
+
+  // A later run without layers overwrites the tree, not its last layer
+  {
+    SofaBranchTree u(ctx);
+    u.add_corner(5);
+    CerealWriter writer(out.c_str());
+    writer << ctx << u;
+    writer.close();
+  }
+  {
+    CerealReader reader(layer_path(out, 3).c_str());
+    SofaContext lctx(reader);
+    SofaBranchTree l(lctx, reader);
+    reader.close();
+    REQUIRE( leaves(l) == leaves(t) );
+  }
+
+  // Restarting the second run after its common prefix
+  {
+    CerealReader reader(layer_path(out, 2).c_str());
+    SofaContext lctx(reader);
+    SofaBranchTree l(lctx, reader, false);
+    reader.close();
+    l.add_corner(5, false);
+
+    SofaBranchTree fresh(ctx);
+    for (const auto &corner : branch_corners(second))
+      fresh.add_corner(corner.first, corner.second);
+    REQUIRE( leaves(l) == leaves(fresh) );
+  }
+
+  // The layers past the reused ones are of the first run
+  start_layers(out, out, second, options, 2);
+  REQUIRE( std::filesystem::exists(layer_path(out, 2)) );
+  REQUIRE( !std::filesystem::exists(layer_path(out, 3)) );
+  REQUIRE( reusable_prefix(out, first, options) == 2 );
+}
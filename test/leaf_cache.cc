@@ -0,0 +1,113 @@
+#include <catch2/catch_all.hpp>
+
+#include <fstream>
+
+#include "sofa/number.h"
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+#include "sofa/bound.h"
+#include "sofa/json.h"
+#include "sofa/leaf_cache.h"
+
+#include "fixtures.h"
+
+TEST_CASE( "Leaf cache shares bounds along a direction", "[CACHE]" ) {
+  SofaContext ctx(small_angles());
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  const auto &s = t.valid_states()[0];
+  auto setup = s.qp_setup();
+
+  auto g = ctx.s(1) * QT(-3) + ctx.s(2) + LinearForm::constant(ctx.d(), 5);
+  auto [f, c] = direction(g);
+  REQUIRE( c == 3 );
+  REQUIRE( f.w0() == 0 );
+  REQUIRE( f * c + LinearForm::constant(ctx.d(), 5) == g );
+  REQUIRE( direction(g * QT(2)).first == f );
+  REQUIRE( direction(-g).first == -f );
+  REQUIRE( direction(LinearForm::constant(ctx.d(), 1)).second == 0 );
+
+  LeafCache cache;
+  cache.put(s, g, {QT(1), QT(2), QT(3, 2), Json::Value()});
+  // 2 * g + 1 is the same direction, scaled and shifted
+  auto b = cache.get(s, setup, g * QT(2) + LinearForm::constant(ctx.d(), 1));
+  REQUIRE( b );
+  REQUIRE( b->lower == 3 );
+  REQUIRE( *b->upper == 5 );
+  REQUIRE( *b->witness == 4 );
+  // the opposite direction bounds the maximum, not the minimum
+  REQUIRE( !cache.get(s, setup, -g) );
+
+  // each end is kept from the better bound
+  cache.put(s, g, {QT(0), QT(3, 2), QT(7, 4), Json::Value()});
+  b = cache.get(s, setup, g);
+  REQUIRE( b->lower == 1 );
+  REQUIRE( *b->upper == QT(3, 2) );
+  REQUIRE( *b->witness == QT(3, 2) );
+  cache.put(s, g, {QT(5, 4), std::nullopt, std::nullopt, Json::Value()});
+  b = cache.get(s, setup, g);
+  REQUIRE( b->lower == QT(5, 4) );
+  REQUIRE( *b->upper == QT(3, 2) );
+
+  // constant forms are not kept
+  cache.put(s, LinearForm::constant(ctx.d(), 1),
+            {QT(1), std::nullopt, std::nullopt, Json::Value()});
+  REQUIRE( !cache.get(s, setup, LinearForm::constant(ctx.d(), 1)) );
+}
+
+TEST_CASE( "Leaf cache loads only bounds it can check", "[CACHE]" ) {
+  SofaContext ctx(small_angles());
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  const auto &s = t.valid_states()[0];
+  auto setup = s.qp_setup();
+
+  auto g = ctx.s(ctx.n());
+  auto h = ctx.s(1);
+  auto sb = min_over_state(s, g, QT(1, 1000), 20);
+  LeafCache cache;
+  cache.put(s, g, {sb.lower, sb.witness, sb.witness, sb.json()});
+  // found by bisection, without a certificate
+  cache.put(s, h, {QT(0), std::nullopt, std::nullopt, Json::Value()});
+  cache.save("leaf.cache", "tree");
+
+  // a cache of another tree is ignored
+  LeafCache other;
+  other.load("leaf.cache", "other");
+  REQUIRE( !other.get(s, setup, g) );
+
+  LeafCache loaded;
+  loaded.load("leaf.cache", "tree");
+  REQUIRE( !loaded.get(s, setup, h) );
+  auto b = loaded.get(s, setup, g);
+  REQUIRE( b );
+  REQUIRE( b->lower == sb.lower );
+  REQUIRE( !b->witness );
+
+  // a lower end beyond its certificate is dropped
+  Json::Value doc;
+  {
+    std::ifstream in("leaf.cache");
+    in >> doc;
+  }
+  REQUIRE( doc["bounds"].size() == 1 );
+  doc["bounds"][0]["lower"] = to_json(sb.lower + QT(1, 1000));
+  {
+    std::ofstream out("leaf.cache");
+    out << doc;
+  }
+  LeafCache forged;
+  forged.load("leaf.cache", "tree");
+  REQUIRE( !forged.get(s, setup, g) );
+
+  // as is one whose certificate is of another direction
+  doc["bounds"][0]["lower"] = to_json(sb.lower);
+  doc["bounds"][0]["certificate"]["form"]["w1"] = to_json(h.w1());
+  {
+    std::ofstream out("leaf.cache");
+    out << doc;
+  }
+  LeafCache moved;
+  moved.load("leaf.cache", "tree");
+  REQUIRE( !moved.get(s, setup, g) );
+}
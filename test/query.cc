@@ -0,0 +1,56 @@
+#include <catch2/catch_all.hpp>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "sofa/number.h"
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+#include "sofa/query.h"
+
+#include "fixtures.h"
+
+TEST_CASE( "A batch of queries gives the bounds of each alone", "[QUERY]" ) {
+  SofaContext ctx(small_angles());
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  t.add_corner(4);
+
+  auto val = ctx.s(ctx.n());
+  auto other = ctx.s(1) - ctx.s(2);
+  std::vector<Query> queries = {
+    {"s(n)", val, true, QT(-4), QT(4)},
+    {"s(n)", val, false, QT(-4), QT(4)},
+    {"s(1) - s(2)", other, true, QT(-4), QT(4)},
+  };
+  QueryOptions options{false, 8, 2, false};
+
+  auto batch = answer(t, false, nullptr, queries, options);
+  REQUIRE( batch.size() == queries.size() );
+  for (size_t k = 0; k < queries.size(); k++) {
+    auto alone = answer(t, false, nullptr, {queries[k]}, options);
+    REQUIRE( !batch[k].error );
+    REQUIRE( batch[k].bound == alone[0].bound );
+    REQUIRE( batch[k].witness == alone[0].witness );
+    REQUIRE( batch[k].json(queries[k])["result"] ==
+             alone[0].json(queries[k])["result"] );
+  }
+  // no sofa is beyond the bounds
+  for (const auto &s : t.valid_states()) {
+    REQUIRE( !s.is_compatible(val <= batch[0].bound - QT(1, 1000000)) );
+    REQUIRE( !s.is_compatible(val >= batch[1].bound + QT(1, 1000000)) );
+  }
+
+  // A search range above the minimum has no bound to find by bisection.
+  // Only that query fails, in its own row.
+  Query bad{"s(n)", val, true, batch[1].bound, batch[1].bound};
+  auto res = answer(t, false, nullptr, {queries[0], bad, queries[1]}, options);
+  REQUIRE( !res[0].error );
+  REQUIRE( res[0].bound == batch[0].bound );
+  REQUIRE( res[1].error == std::optional<std::string>("Bound invalid") );
+  REQUIRE( res[1].json(bad)["error"] == "Bound invalid" );
+  REQUIRE( !res[1].json(bad).isMember("result") );
+  REQUIRE( !res[2].error );
+  REQUIRE( res[2].bound == batch[1].bound );
+}
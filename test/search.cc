@@ -8,6 +8,8 @@
 #include "sofa/qp.h"
 #include "sofa/branch_tree.h"
 
+#include "fixtures.h"
+
 TEST_CASE( "Search tree", "[.][SEARCH]" ) {
   SofaContext ctx( {
       {QT{2496,2545}, QT{497,2545}}, 
@@ -42,3 +44,36 @@ TEST_CASE( "Search tree", "[.][SEARCH]" ) {
   std::cout << t.valid_states().size() << std::endl;
   */
 }
+
+TEST_CASE( "Locating corners by bisection keeps the maximum area",
+           "[SEARCH]" ) {
+  SofaContext ctx(small_angles());
+
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  t.add_corner(4);
+  t.add_corner(2);
+
+  SofaBranchTree t2(ctx);
+  t2.bisect(true);
+  t2.add_corner(3);
+  t2.add_corner(4);
+  t2.add_corner(2);
+
+  REQUIRE( max_leaf_area(t2) == max_leaf_area(t) );
+}
+
+TEST_CASE( "Pipelined corners give the same leaves", "[SEARCH]" ) {
+  SofaContext ctx(small_angles());
+
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  t.add_corner(4);
+  t.add_corner(2);
+
+  SofaBranchTree t2(ctx);
+  // Small enough to hold states back from the first corner
+  t2.add_corners({{3, true}, {4, true}, {2, true}}, 4, 2);
+
+  REQUIRE( leaves(t2) == leaves(t) );
+}
@@ -0,0 +1,96 @@
+#include <catch2/catch_all.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include "sofa/number.h"
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+#include "sofa/cereal.h"
+#include "sofa/leaf_cache.h"
+#include "sofa/parse.h"
+#include "sofa/query.h"
+#include "sofa/server.h"
+
+#include "fixtures.h"
+
+TEST_CASE( "Query server replies to each line", "[SERVER]" ) {
+  SofaContext ctx(small_angles());
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  t.add_corner(4);
+  LeafCache cache;
+  QueryServer server(t, false, nullptr, cache, {false, 6, 1, false});
+
+  REQUIRE( server.reply("set bsearch-depth 8")["bsearch-depth"] == 8 );
+  for (auto line : {"set bsearch-depth 0", "set bsearch-depth -3",
+                    "set bsearch-depth 65", "set bsearch-depth 99999999999",
+                    "set bsearch-depth 2x", "set bsearch-depth",
+                    "set exact maybe", "set color red"})
+    REQUIRE( server.reply(line).isMember("error") );
+  // rejected settings are not kept
+  auto set = server.reply("set exact off");
+  REQUIRE( set["bsearch-depth"] == 8 );
+  REQUIRE( set["exact"] == false );
+
+  for (auto line : {"lb 1 0 A(2).x", "lb a 1 A(2).x", "ub 0 1/0 A(2).x",
+                    "ub 0 1 A(99).x", "ub 0 1 x(-1).x", "ub 0 1 A(2).x)",
+                    "lb 0 1", "compatible A(2).x", "frobnicate"})
+    REQUIRE( server.reply(line).isMember("error") );
+
+  // a bound is the one of `answer`
+  Parser parser(ctx);
+  Query q{"A(2).x", parser.parse_expr("A(2).x"), true, QT(-4), QT(4)};
+  auto res = answer(t, false, nullptr, {q}, {false, 8, 1, false});
+  REQUIRE( server.reply("lb -4 4 A(2).x") == res[0].json(q) );
+
+  auto cmp = server.reply("compatible A(2).x>=0");
+  REQUIRE( !cmp.isMember("error") );
+  REQUIRE( cmp["leaves"].asUInt64() == t.valid_states().size() );
+  REQUIRE( cmp["compatible"].asUInt64() <= t.valid_states().size() );
+}
+
+TEST_CASE( "A served tree replies on the first line", "[SERVER]" ) {
+  SofaContext ctx(small_angles());
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  t.add_corner(4);
+  {
+    CerealWriter w("served.crl");
+    w << ctx << t;
+    w.close();
+  }
+
+  // Standard output goes to a file, as to a client of --serve,
+  // while the tree is loaded and the server replies
+  std::fflush(stdout);
+  int saved = dup(fileno(stdout));
+  FILE *f = std::fopen("served.out", "w");
+  REQUIRE( f );
+  dup2(fileno(f), fileno(stdout));
+  {
+    CerealReader r("served.crl");
+    SofaContext rctx(r);
+    SofaBranchTree rt(rctx, r, true, false);
+    r.close();
+    LeafCache cache;
+    QueryServer server(rt, false, nullptr, cache, {false, 6, 1, false});
+    std::istringstream in("\nset exact off\nquit\nset exact on\n");
+    server.serve(in, std::cout);
+  }
+  std::fflush(stdout);
+  dup2(saved, fileno(stdout));
+  close(saved);
+  std::fclose(f);
+
+  std::ifstream out("served.out");
+  std::string line;
+  REQUIRE( std::getline(out, line) );
+  REQUIRE( line == "{\"bsearch-depth\":6,\"exact\":false}" );
+  // nothing is read past `quit`
+  REQUIRE( !std::getline(out, line) );
+}
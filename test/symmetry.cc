@@ -0,0 +1,45 @@
+#include <catch2/catch_all.hpp>
+
+#include "sofa/number.h"
+#include "sofa/context.h"
+#include "sofa/branch_tree.h"
+
+#include "fixtures.h"
+
+TEST_CASE( "Reflection maps probes and areas", "[SYMMETRY]" ) {
+  SofaContext ctx(small_angles());
+  REQUIRE( ctx.is_symmetric() );
+  REQUIRE( !SofaContext({{QT{3,5},QT{4,5}}, {QT{5,13},QT{12,13}}}).
+           is_symmetric() );
+
+  auto p = ctx.symmetry_probe();
+  REQUIRE( ctx.mirror_probe(p) == -p );
+
+  std::vector<int> e = {0, 1, 2, 5, -3, 4, -4, 3, -5, -2, -1, 0};
+  for (int t = 0; t < 5; t++) {
+    std::vector<QT> v(ctx.d());
+    for (int k = 0; k < ctx.d(); k++)
+      v[k] = QT((k * 37 + t * 101) % 211 - 50, 97);
+    auto mv = ctx.mirror_vars(v);
+    REQUIRE( ctx.mirror_vars(mv) == v );
+    REQUIRE( ctx.area(e)(v) == ctx.area(ctx.mirror_niche(e))(mv) );
+    for (int q = 1; q < ctx.extra_ineqs_offset(); q++)
+      REQUIRE( ctx.ineq(q)(v) == ctx.ineq(ctx.mirror_probe(q))(mv) );
+  }
+}
+
+TEST_CASE( "Branching half of the sofas keeps the maximum area",
+           "[SYMMETRY]" ) {
+  SofaContext ctx(small_angles());
+
+  SofaBranchTree t(ctx);
+  t.add_corner(3);
+  t.add_corner(4);
+
+  SofaBranchTree t2(ctx);
+  t2.break_symmetry();
+  t2.add_corner(3);
+  t2.add_corner(4);
+
+  REQUIRE( max_leaf_area(t2) == max_leaf_area(t) );
+}
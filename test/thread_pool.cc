@@ -0,0 +1,51 @@
+#include <catch2/catch_all.hpp>
+
+#include <atomic>
+#include <stdexcept>
+
+#include "sofa/thread_pool.h"
+
+TEST_CASE( "Thread pool runs every task once", "[THREAD]" ) {
+  ThreadPool pool(3);
+
+  std::atomic<long> sum(0);
+  pool.parallel_for(1000, [&](size_t i) { sum += i; });
+  REQUIRE( sum == 499500 );
+
+  long total = pool.reduce(
+      1000, 0L,
+      [](size_t i) { return long(i); },
+      [](long a, long b) { return a + b; });
+  REQUIRE( total == 499500 );
+
+  // nested calls run inline instead of waiting for a free worker
+  std::atomic<int> count(0);
+  pool.run(4, [&](int) {
+    pool.run(3, [&](int) { count++; });
+  });
+  REQUIRE( count == 12 );
+
+  REQUIRE( pool.submit([]() { return ThreadPool::worker_id(); }).get() >= 0 );
+  REQUIRE( ThreadPool::worker_id() == -1 );
+
+  REQUIRE_THROWS_AS(
+      pool.run(3, [](int rnk) {
+        if (rnk == 1)
+          throw std::runtime_error("task failed");
+      }),
+      std::runtime_error );
+}
+
+TEST_CASE( "Pinned thread pool covers its nodes", "[THREAD]" ) {
+  ThreadPool pool(4, true);
+  REQUIRE( pool.is_pinned() );
+  REQUIRE( pool.num_nodes() >= 1 );
+  // consecutive workers share nodes
+  for (int id = 1; id < pool.size(); id++)
+    REQUIRE( pool.node_of(id - 1) <= pool.node_of(id) );
+  REQUIRE( pool.node_of(pool.size() - 1) == pool.num_nodes() - 1 );
+
+  std::atomic<long> sum(0);
+  pool.parallel_for(100, [&](size_t i) { sum += i; });
+  REQUIRE( sum == 4950 );
+}